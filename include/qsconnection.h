@@ -10,9 +10,13 @@
 #include <QHash>
 #include <QLocale>
 #include <QString>
+#include <QVector>
 
 #include "sqlite3.h"
+#include "qsfunction.h"
 #include "qsstatement.h"
+#include "qsvaluetraits.h"
+#include "qsvirtualtable.h"
 
 
 struct sqlite3;
@@ -28,6 +32,8 @@ public:
     friend QsStatement::QsStatement(const QsConnection& connection,
                                     const QString&      query) noexcept;
 
+    friend class QsError;
+
     /*
     friend void swap(QsConnection& first, QsConnection& second) noexcept
     {
@@ -38,6 +44,12 @@ public:
     }
     */
 
+    // value and ReadResult (or sqlite error) code of read operations
+    using DoubleResult   = std::pair<double,     int>;
+    using Int64Result    = std::pair<qint64,     int>;
+    using StringResult   = std::pair<QByteArray, int>;
+    using String16Result = std::pair<QString,    int>;
+
     enum QueryResult {
         Ok = 0
     };
@@ -69,6 +81,38 @@ public:
         SingleThread
     };
 
+    // text encoding of database (UTF-16 is native byte order, so QString
+    // values are stored and read without transcoding)
+    enum Encoding {
+        Utf8 = 0,
+        Utf16
+    };
+
+    // mode of WAL checkpoint (see sqlite3_wal_checkpoint_v2)
+    enum CheckpointMode {
+        PassiveCheckpoint = 0,
+        FullCheckpoint,
+        RestartCheckpoint,
+        TruncateCheckpoint
+    };
+
+    // type of transaction, started by transaction() (write transactions
+    // should be Immediate to avoid busy errors on lock upgrade)
+    enum TransactionType {
+        Deferred = 0,
+        Immediate,
+        Exclusive
+    };
+
+    // flags for user-defined functions (see SQLITE_DETERMINISTIC,
+    // SQLITE_INNOCUOUS and SQLITE_DIRECTONLY)
+    enum FunctionFlag {
+        NoFunctionFlags = 0x0,
+        Deterministic   = 0x1,
+        Innocuous       = 0x2,
+        DirectOnly      = 0x4
+    };
+
     // default CacheMode value for initializing object in constructor
     static const CacheMode defaultCacheMode { CacheMode::PrivateCache };
 
@@ -78,47 +122,229 @@ public:
     // default ThreadMode value for initializing object in constructor
     static const ThreadMode defaultThreadMode { ThreadMode::Default };
 
+    // default max count of statements in cache of compiled statements
+    // (least recently used statement is deleted, when cache is full)
+    static const int defaultStatementCacheSize { 64 };
+
+    // default max delay (milliseconds) between retries of busy handler
+    static const int defaultBusyMaxDelay { 50 };
+
+    // lock contention statistics of busy handler (see setBusyTimeout)
+    struct BusyStatistics {
+        qint64 busyCount;     // count of lock conflicts
+        qint64 retryCount;    // count of retries after waiting
+        qint64 timeoutCount;  // count of conflicts, failed after timeout
+        qint64 waitTime;      // total waiting time (microseconds)
+    };
+
+    // issues of query plan, found by plan check (flags)
+    enum PlanIssue {
+        NoPlanIssue   = 0,
+        FullTableScan = 1,  // all rows of table (or index) are scanned
+        TempBTree     = 2   // rows are sorted or grouped by temp b-tree
+    };
+
+    // statistics of plan check (see setPlanCheck)
+    struct PlanCheckStatistics {
+        qint64 checkedCount;    // count of checked queries
+        qint64 fullScanCount;   // count of queries with full table scan
+        qint64 tempBTreeCount;  // count of queries with temp b-tree
+    };
+
+    // operation of row change (see setRowChangeHandler); UntrackedChange
+    // means that rows of any table may be changed (its names are empty)
+    enum RowOperation {
+        RowInserted = 0,
+        RowUpdated,
+        RowDeleted,
+        UntrackedChange
+    };
+
+    // changed row (names are shared between changes of same table)
+    struct RowChange {
+        QByteArray   database;  // "main", "temp" or name of attached db
+        QByteArray   table;
+        qint64       rowId;
+        RowOperation operation;
+    };
+
+    // statistics of key filter (see addKeyFilter)
+    struct KeyFilterStatistics {
+        qint64 keyCount;           // count of added keys
+        double saturation;         // part of set bits of filter
+        double falsePositiveRate;  // estimated for missing key
+        qint64 skippedCount;       // lookups, rejected by filter
+        qint64 passedCount;        // lookups, passed to sqlite
+    };
+
+    using RowChanges       = QVector<RowChange>;
+    using RowChangeHandler = std::function<void (const RowChanges& changes)>;
+
+    // handler of query with plan issues (PlanIssue flags)
+    using PlanCheckHandler =
+        std::function<void (const QByteArray&             query,
+                            int                           issues,
+                            const QsStatement::QueryPlan& plan)>;
+
+    // state of WAL database, seen by read transaction (see takeSnapshot)
+    using Snapshot = std::shared_ptr<sqlite3_snapshot>;
+
     QsConnection(const QByteArray& dbName = QByteArray()) Q_DECL_NOTHROW;
 
     QsConnection(QsConnection&& connection) Q_DECL_NOTHROW;
 
     virtual ~QsConnection();
 
+    // build Bloom filter of values of key column of rowid table (table
+    // is scanned once) and return its handle (or -1 on error); keys of
+    // inserted and updated rows are added by update hook, so mayContainKey
+    // rejects most missing keys without sqlite; filter is sized for
+    // 'expectedKeys' (at least for current rows) and sees changes of this
+    // connection only, so it must be rebuilt after changes of other
+    // connections; keys of deleted rows stay in filter, so it saturates
+    // (see keyFilterStatistics and rebuildKeyFilter); filters are removed,
+    // when connection is closed; key column must have BINARY collation
+    // (filter compares bytes of keys), and names are case-insensitive
+    // (as in SQL)
+    int addKeyFilter(const QByteArray& table,
+                     const QByteArray& column,
+                     qint64            expectedKeys = 0,
+                     const QByteArray& database     = QByteArray());
+
+    // begin nested transaction (savepoint) and return its level, which
+    // starts from 1 (or return 0 on fail); if there is no transaction,
+    // savepoint begins deferred transaction, which is committed on release
+    // of level 1 (see QsSavepoint for RAII guard)
+    int beginSavepoint() noexcept;
+
+    BusyStatistics busyStatistics() const noexcept;
+
+    int busyTimeout() const noexcept;
+
+    // run WAL checkpoint for database (or for all attached databases,
+    // if 'schemaName' is empty); 'walFrames' receives size of WAL (frames),
+    // 'checkpointedFrames' receives count of frames, copied to database
+    bool checkpoint(CheckpointMode    mode               = PassiveCheckpoint,
+                    int*              walFrames          = nullptr,
+                    int*              checkpointedFrames = nullptr,
+                    const QByteArray& schemaName = QByteArray()) noexcept;
+
+    void clearStatementCache() noexcept;
+
+    // pass row changes of committed transactions to row change handler
+    // (call it after statement or transaction ends; nothing is passed,
+    // if there are no committed changes)
+    void flushRowChanges();
+
     void close() Q_DECL_NOTHROW;
 
     bool commit() Q_DECL_NOTHROW;
 
+    // register aggregate function; 'step' is called as
+    // void (State& state, Args... args) for every row, and 'final' is called
+    // as Result (State& state) to get result (State is default-constructed)
+    template<typename State, typename Step, typename Final>
+    bool createAggregateFunction(const QByteArray& name,
+                                 Step              step,
+                                 Final             final,
+                                 int               flags = NoFunctionFlags);
+
+    // register scalar function; 'function' is called with arguments of its
+    // own types (bool, int, qint64, double, QByteArray or QString)
+    template<typename Function>
+    bool createFunction(const QByteArray& name,
+                        Function          function,
+                        int               flags = NoFunctionFlags);
+
     bool createUtf16Collation(const QByteArray& collationName,
                               const QLocale&    locale);
 
+    // register virtual table module; eponymous-only table is used by module
+    // name directly, otherwise tables can be created with
+    // "create virtual table <name> using <moduleName>" also
+    bool createVirtualTable(const QByteArray&                   moduleName,
+                            std::shared_ptr<QsVirtualTableBase> table,
+                            bool                                eponymousOnly
+                                                                    = true);
+
+    // register aggregate window function; in addition to aggregate function
+    // callbacks, 'inverse' removes row from state (same signature as 'step')
+    // and 'value' returns current result as Result (State& state)
+    template<typename State, typename Step, typename Inverse,
+             typename Value, typename Final>
+    bool createWindowFunction(const QByteArray& name,
+                              Step              step,
+                              Inverse           inverse,
+                              Value             value,
+                              Final             final,
+                              int               flags = NoFunctionFlags);
+
+    bool deleteFunction(const QByteArray& name,
+                        int               argumentCount);
+
     bool deleteUtf16Collation(const QByteArray& collationName);
 
+    // replace database by image (read-only image is used without copying
+    // and is kept until connection is closed)
+    bool deserialize(const QByteArray& image,
+                     const QByteArray& schemaName = QByteArray(),
+                     bool              readOnly   = false);
+
     bool execute(const QByteArray& query) const noexcept;
 
-    inline bool execute(const QString& query) const;
+    // execute statements of query, compiled from UTF-16 text
+    bool execute(const QString& query) const;
 
     inline QByteArray databaseName() const Q_DECL_NOTHROW
     {
         return _dbName;
     }
 
+    // return text encoding of opened database (read once per connection)
+    Encoding encoding() const noexcept;
+
     inline bool isOpen() const noexcept
     {
         return _db != NULL;
     }
 
+    // check if database is opened read-only (by open mode or because
+    // database file is not writable)
+    bool isReadOnly(const QByteArray& schemaName = QByteArray()) const noexcept;
+
+    KeyFilterStatistics keyFilterStatistics(int filterHandle) const noexcept;
+
     int lastErrorCode() const noexcept;
 
+    int lastExtendedErrorCode() const noexcept;
+
     QByteArray lastError() const;
 
     QString lastError16() const;
 
     qint64 lastInsertRowId() const noexcept;
 
+    // check key (integer, real number, QByteArray, QString or C string)
+    // by key filter: false means, that column has no such key; key must
+    // have canonical form of column values (e.g. integer for INTEGER
+    // column), and unknown handle gives true
+    template<typename Key>
+    inline bool mayContainKey(int filterHandle, const Key& key) noexcept
+    {
+        return mayContainHash(filterHandle, keyHash(key));
+    }
+
     bool open(OpenMode   openMode   = defaultOpenMode,
               ThreadMode threadMode = defaultThreadMode,
               CacheMode  cacheMode  = defaultCacheMode);
 
+    // start read transaction of deferred transaction (which must not read
+    // anything yet) on snapshot of other connection to same WAL database,
+    // so both connections see same state; return sqlite result code
+    // (snapshot is not available after checkpoint has reset WAL)
+    int openSnapshot(const Snapshot&   snapshot,
+                     const QByteArray& schemaName = QByteArray()) noexcept;
+
     inline QsStatement prepare(const QByteArray& query) Q_DECL_NOTHROW
     {
         return QsStatement(*this, query);
@@ -129,27 +355,204 @@ public:
         return QsStatement(*this, query);
     }
 
+    // compile statement into statement cache (if it is not compiled yet),
+    // so first parameterized or batch read with it does not compile it
+    bool prepareCached(const QByteArray& query) noexcept;
+
+    PlanCheckStatistics planCheckStatistics() const noexcept;
+
+    // return PlanIssue flags of query plan
+    static int planIssues(const QsStatement::QueryPlan& plan) noexcept;
+
+    // read one value of type T (bool, int, qint64, double, QByteArray or
+    // QString) for each key, bound to parameter of query (query must have
+    // one parameter; statement is compiled once for all keys)
+    template<typename T, typename Key>
+    QVector<std::pair<T, int> > readBatch(const QByteArray&   query,
+                                          const QVector<Key>& keys);
+
+    // read value of type T by key (see readInt64 with parameters), which is
+    // checked by key filter first, so missing key gives EmptyData without
+    // sqlite call
+    template<typename T, typename Key>
+    inline std::pair<T, int> readByKey(int               filterHandle,
+                                       const QByteArray& query,
+                                       const Key&        key)
+    {
+        if (!mayContainKey(filterHandle, key)) {
+            return std::pair<T, int>(T(), EmptyData);
+        }
+
+        return readCached<T>(query, key);
+    }
+
     std::pair<double, int> readDouble(const QByteArray& query);
 
+    template<typename Key>
+    inline QVector<DoubleResult> readDoubleBatch(const QByteArray&   query,
+                                                 const QVector<Key>& keys)
+    {
+        return readBatch<double>(query, keys);
+    }
+
     std::pair<double, int> readDouble(const QString& query);
 
+    // read value with parameters, bound to query by position (bool, int,
+    // qint64, double, QByteArray, QString, const char* or nullptr; count
+    // of values must be equal to count of query parameters, otherwise
+    // result code is SQLITE_RANGE); compiled statement is saved in
+    // statement cache and reused
+    template<typename... Args>
+    inline DoubleResult readDouble(const QByteArray& query,
+                                   const Args&...    args)
+    {
+        return readCached<double>(query, args...);
+    }
+
     std::pair<qint64, int> readInt64(const QByteArray& query);
 
     std::pair<qint64, int> readInt64(const QString& query);
 
+    template<typename... Args>
+    inline Int64Result readInt64(const QByteArray& query,
+                                 const Args&...    args)
+    {
+        return readCached<qint64>(query, args...);
+    }
+
+    template<typename Key>
+    inline QVector<Int64Result> readInt64Batch(const QByteArray&   query,
+                                               const QVector<Key>& keys)
+    {
+        return readBatch<qint64>(query, keys);
+    }
+
     std::pair<QByteArray, int> readString(const QByteArray& query);
 
     std::pair<QByteArray, int> readString(const QString& query);
 
+    template<typename... Args>
+    inline StringResult readString(const QByteArray& query,
+                                   const Args&...    args)
+    {
+        return readCached<QByteArray>(query, args...);
+    }
+
+    template<typename Key>
+    inline QVector<StringResult> readStringBatch(const QByteArray&   query,
+                                                 const QVector<Key>& keys)
+    {
+        return readBatch<QByteArray>(query, keys);
+    }
+
     std::pair<QString, int> readString16(const QByteArray& query);
 
     std::pair<QString, int> readString16(const QString& query);
 
+    template<typename... Args>
+    inline String16Result readString16(const QByteArray& query,
+                                       const Args&...    args)
+    {
+        return readCached<QString>(query, args...);
+    }
+
+    template<typename Key>
+    inline QVector<String16Result> readString16Batch(const QByteArray&   query,
+                                                     const QVector<Key>& keys)
+    {
+        return readBatch<QString>(query, keys);
+    }
+
+    // scan table of key filter again (e.g. if filter is saturated or table
+    // is changed by other connection); see addKeyFilter
+    bool rebuildKeyFilter(int filterHandle, qint64 expectedKeys = 0);
+
+    // release savepoint of level (and nested savepoints), so its changes
+    // become part of outer transaction
+    bool releaseSavepoint(int level) noexcept;
+
+    void removeKeyFilters() noexcept;
+
+    void resetBusyStatistics() noexcept;
+
     bool rollback() Q_DECL_NOTHROW;
 
+    // rollback changes since savepoint of level and release it
+    bool rollbackSavepoint(int level) noexcept;
+
+    inline int savepointLevel() const noexcept
+    {
+        return _savepointLevel;
+    }
+
+    // copy database image (result is empty on error or for image, which is
+    // larger than QByteArray can hold)
+    QByteArray serialize(const QByteArray& schemaName = QByteArray()) const;
+
+    // wrap contiguous image of in-memory database without copying (data is
+    // valid until next change of database; empty if there is no such image)
+    QByteArray
+    serializeNoCopy(const QByteArray& schemaName = QByteArray()) const noexcept;
+
+    // install busy handler, which retries locked operation with jittered
+    // exponential backoff (from 1 ms to 'maxDelay' ms) until total waiting
+    // time of conflict exceeds 'timeout' ms (0 removes busy handler)
+    void setBusyTimeout(int timeout, int maxDelay = defaultBusyMaxDelay);
+
     void setDatabaseName(const QByteArray& dbName) Q_DECL_NOTHROW;
 
-    bool transaction() Q_DECL_NOTHROW;
+    // check plan of each query on its first prepare (by QsStatement or
+    // statement cache) and count full table scans and temp b-tree sorts;
+    // handler is called for query with issues (check runs EXPLAIN QUERY
+    // PLAN once per distinct query until connection is closed, so it can
+    // be kept enabled in production; disabling keeps statistics)
+    void setPlanCheck(bool             enabled,
+                      PlanCheckHandler handler = PlanCheckHandler());
+
+    // track changed rows (with update, commit and rollback hooks): changes
+    // are buffered during transaction and passed to handler by
+    // flushRowChanges() after commit, and changes of rolled back
+    // transaction are dropped (changes of statements, rolled back to
+    // savepoint, are kept, so handler must treat them as invalidation
+    // hint); changes, which update hook does not see (delete of all rows
+    // by truncate optimization, changes of WITHOUT ROWID tables), are found
+    // by count of changes (see totalChanges) and passed as one
+    // UntrackedChange, when transaction is ended; rows, deleted by REPLACE
+    // conflict resolution, are neither seen by update hook nor counted
+    // by sqlite, so only inserted row is passed for them; commit hook runs
+    // before commit, which may still fail (e.g. with SQLITE_BUSY) and keep
+    // transaction open, so passed changes may include rows of transaction,
+    // which is rolled back later; empty handler stops tracking
+    void setRowChangeHandler(RowChangeHandler handler);
+
+    // set text encoding of database (it can be changed only before
+    // database content is created, so result is true, if database
+    // has requested encoding)
+    bool setEncoding(Encoding encoding) noexcept;
+
+    // set hook, called after commit in WAL mode with count of WAL pages
+    // (hook replaces automatic checkpoints of sqlite; NULL removes it)
+    bool setWalHook(int (*hook)(void*, sqlite3*, const char*, int),
+                    void* data) noexcept;
+
+    void setStatementCacheSize(int size) noexcept;
+
+    inline int statementCacheSize() const noexcept
+    {
+        return _statementCacheSize;
+    }
+
+    // count of rows, changed by connection since it is opened (including
+    // changes, which are not seen by update hook, e.g. delete of all rows)
+    int totalChanges() const noexcept;
+
+    // take snapshot of current read transaction (transaction must have read
+    // database); result is NULL, if database is not in WAL mode or sqlite
+    // is built without SQLITE_ENABLE_SNAPSHOT
+    Snapshot
+    takeSnapshot(const QByteArray& schemaName = QByteArray()) const noexcept;
+
+    bool transaction(TransactionType type = Deferred) Q_DECL_NOTHROW;
 
     QsConnection& operator =(QsConnection&& connection) Q_DECL_NOTHROW;
 
@@ -158,21 +561,319 @@ public:
 
 private:
 
+    struct BusyHandler;
+    struct KeyFilter;
+    struct PlanChecker;
+    struct RowChangeTracker;
+
+    // transaction control statements, compiled once per connection
+    enum ControlStatement {
+        BeginDeferred = 0,
+        BeginImmediate,
+        BeginExclusive,
+        CommitTransaction,
+        RollbackTransaction,
+        ControlStatementCount
+    };
+
     sqlite3*   _db;
     QByteArray _dbName;
     QByteArray _openErrorMsg;
 
+    // text encoding of database (read on first request)
+    mutable Encoding _encoding;
+    mutable bool     _encodingKnown;
+
     QHash<QByteArray, std::shared_ptr<QCollator> > _collators;
 
+    // read-only images, attached by deserialize() without copying
+    QHash<QByteArray, QByteArray> _images;
+
+    // compiled statement of cache and its last use (value of _statementUse)
+    struct CachedStatement {
+        sqlite3_stmt* stmt;
+        quint64       lastUse;
+    };
+
+    QHash<QByteArray, CachedStatement> _statementCache;
+    int                                _statementCacheSize;
+    quint64                            _statementUse;
+
+    sqlite3_stmt* _controlStatements[ControlStatementCount];
+
+    // savepoint statements (begin, release and rollback for each level)
+    enum SavepointStatement {
+        SavepointBegin = 0,
+        SavepointRelease,
+        SavepointRollback,
+        SavepointStatementCount
+    };
+
+    QVector<sqlite3_stmt*> _savepointStatements;
+    int                    _savepointLevel;
+
+    // state of busy handler (it keeps address, when connection is moved)
+    std::unique_ptr<BusyHandler> _busyHandler;
+
+    // state of plan check (enabled by setPlanCheck)
+    std::unique_ptr<PlanChecker> _planChecker;
+
+    // buffered row changes (it keeps address, when connection is moved)
+    std::unique_ptr<RowChangeTracker> _rowChangeTracker;
+
+    // install (or remove) hooks of row change tracker
+    void installRowChangeHooks() noexcept;
+
+    // scan table into key filter
+    bool buildKeyFilter(KeyFilter& filter, qint64 expectedKeys);
+
+    // add keys of changed rows to key filter (filter is turned off, if
+    // keys can not be read)
+    void syncKeyFilter(KeyFilter& filter) noexcept;
+
+    bool mayContainHash(int filterHandle, quint64 hash) noexcept;
+
+    static quint64 keyHash(int key) noexcept;
+
+    static quint64 keyHash(qint64 key) noexcept;
+
+    static quint64 keyHash(double key) noexcept;
+
+    static quint64 keyHash(const QByteArray& key) noexcept;
+
+    static quint64 keyHash(const QString& key) noexcept;
+
+    static quint64 keyHash(const char* key) noexcept;
+
+    // bind values to all statement parameters, starting from first
+    // (SQLITE_RANGE, if count of values differs from count of parameters,
+    // so values of previous read are never reused)
+    template<typename... Args>
+    static int bindValues(sqlite3_stmt* stmt, const Args&... args) noexcept;
+
+    int cachedStatement(const QByteArray& query,
+                        sqlite3_stmt**    stmt) noexcept;
+
+    // delete least recently used statement of statement cache
+    void evictCachedStatement() noexcept;
+
+    // check plan of newly compiled statement (if plan check is enabled)
+    void checkPlan(sqlite3_stmt* stmt) const noexcept;
+
+    void clearControlStatements() noexcept;
+
     int openInMemoryDb(CacheMode cacheMode);
 
+    bool registerFunction(const QByteArray& name,
+                          int               argumentCount,
+                          int               flags,
+                          void*             function,
+                          void (*xFunc)(sqlite3_context*, int, sqlite3_value**),
+                          void (*xStep)(sqlite3_context*, int, sqlite3_value**),
+                          void (*xFinal)(sqlite3_context*),
+                          void (*xDestroy)(void*));
+
+    bool registerWindowFunction(
+            const QByteArray& name,
+            int               argumentCount,
+            int               flags,
+            void*             function,
+            void (*xStep)(sqlite3_context*, int, sqlite3_value**),
+            void (*xFinal)(sqlite3_context*),
+            void (*xValue)(sqlite3_context*),
+            void (*xInverse)(sqlite3_context*, int, sqlite3_value**),
+            void (*xDestroy)(void*));
+
     int openRegularDb(const int flags) noexcept;
 
+    int prepareRead(const QByteArray& query,
+                    sqlite3_stmt**    stmt) noexcept;
+
+    int stepRead(sqlite3_stmt* stmt) noexcept;
+
+    template<typename T, typename... Args>
+    std::pair<T, int> readCached(const QByteArray& query,
+                                 const Args&...    args);
+
     int readValue(const QByteArray&                          query,
                   const std::function<void (sqlite3_stmt*)>& readLambda);
 
+    int readValue(const QString&                             query,
+                  const std::function<void (sqlite3_stmt*)>& readLambda);
+
+    // read first value of prepared statement and delete statement
+    static int readFirstValue(
+            sqlite3_stmt*                              stmt,
+            const std::function<void (sqlite3_stmt*)>& readLambda);
+
     void reset() noexcept;
 
+    bool isSavepointActive(int level) noexcept;
+
+    bool runControlStatement(ControlStatement statement) noexcept;
+
+    bool runSavepointStatement(int                level,
+                               SavepointStatement statement) noexcept;
+
+    bool runStatement(sqlite3_stmt*& stmt, const char* query) noexcept;
+
 };
 
+template<typename State, typename Step, typename Final>
+bool QsConnection::createAggregateFunction(const QByteArray& name,
+                                           Step              step,
+                                           Final             final,
+                                           const int         flags)
+{
+    using Function = qs::detail::AggregateFunction<State, Step, Final>;
+
+    // check if connection is opened
+    if (!_db) {
+        return false;
+    }
+
+    // function object is deleted by sqlite (with xDestroy)
+    Function* function = new Function {std::move(step), std::move(final),
+                                       nullptr, nullptr};
+
+    return registerFunction(name, Function::arity, flags, function,
+                            NULL, &Function::callStep, &Function::callFinal,
+                            &Function::destroy);
+}
+
+template<typename T, typename Key>
+QVector<std::pair<T, int> >
+QsConnection::readBatch(const QByteArray&   query,
+                        const QVector<Key>& keys)
+{
+    QVector<std::pair<T, int> > results;
+    results.reserve(keys.size());
+
+    // try get compiled statement (on fail, set result code for all keys)
+    sqlite3_stmt* stmt = NULL;
+    const int prepareCode = prepareRead(query, &stmt);
+    if (prepareCode != SQLITE_OK) {
+        results.fill(std::pair<T, int>(T(), prepareCode), keys.size());
+        return results;
+    }
+
+    try {
+        // bind each key, step and read value, then reset statement
+        for (const Key& key : keys) {
+            std::pair<T, int> result(T(), bindValues(stmt, key));
+            if (result.second == SQLITE_OK
+                    && (result.second = stepRead(stmt)) == ReadSuccess) {
+                result.first = QsValueTraits<T>::fromColumn(stmt, 0);
+            }
+
+            sqlite3_reset(stmt);
+            results.append(std::move(result));
+        }
+    } catch (...) {
+        // reset cached statement and re-throw
+        sqlite3_reset(stmt);
+        throw;
+    }
+
+    return results;
+}
+
+template<typename... Args>
+int QsConnection::bindValues(sqlite3_stmt* stmt, const Args&... args) noexcept
+{
+    if (sqlite3_bind_parameter_count(stmt)
+            != static_cast<int>(sizeof...(Args))) {
+        return SQLITE_RANGE;
+    }
+
+    int resultCode = SQLITE_OK;
+    int index = 0;
+
+    // bind values in order, while binding succeeds
+    using Expander = int[];
+    (void) Expander {0, (resultCode == SQLITE_OK
+                         ? (resultCode = QsValueTraits<
+                            typename std::decay<Args>::type>::bind(
+                                stmt, ++index, args))
+                         : 0)...};
+
+    return resultCode;
+}
+
+template<typename T, typename... Args>
+std::pair<T, int> QsConnection::readCached(const QByteArray& query,
+                                           const Args&...    args)
+{
+    std::pair<T, int> result(T(), ReadSuccess);
+
+    // try get compiled statement
+    sqlite3_stmt* stmt = NULL;
+    result.second = prepareRead(query, &stmt);
+    if (result.second != SQLITE_OK) {
+        return result;
+    }
+
+    // bind parameters, step and read value
+    result.second = bindValues(stmt, args...);
+    if (result.second == SQLITE_OK
+            && (result.second = stepRead(stmt)) == ReadSuccess) {
+        try {
+            result.first = QsValueTraits<T>::fromColumn(stmt, 0);
+        } catch (...) {
+            // reset cached statement and re-throw
+            sqlite3_reset(stmt);
+            throw;
+        }
+    }
+
+    // reset statement to release read lock
+    sqlite3_reset(stmt);
+    return result;
+}
+
+template<typename Function>
+bool QsConnection::createFunction(const QByteArray& name,
+                                  Function          function,
+                                  const int         flags)
+{
+    using Scalar = qs::detail::ScalarFunction<Function>;
+
+    // check if connection is opened
+    if (!_db) {
+        return false;
+    }
+
+    // function object is deleted by sqlite (with xDestroy)
+    return registerFunction(name, Scalar::Traits::arity, flags,
+                            new Function(std::move(function)),
+                            &Scalar::call, NULL, NULL, &Scalar::destroy);
+}
+
+template<typename State, typename Step, typename Inverse,
+         typename Value, typename Final>
+bool QsConnection::createWindowFunction(const QByteArray& name,
+                                        Step              step,
+                                        Inverse           inverse,
+                                        Value             value,
+                                        Final             final,
+                                        const int         flags)
+{
+    using Function = qs::detail::AggregateFunction<State, Step, Final,
+                                                   Inverse, Value>;
+
+    // check if connection is opened
+    if (!_db) {
+        return false;
+    }
+
+    // function object is deleted by sqlite (with xDestroy)
+    Function* function = new Function {std::move(step), std::move(final),
+                                       std::move(inverse), std::move(value)};
+
+    return registerWindowFunction(name, Function::arity, flags, function,
+                                  &Function::callStep, &Function::callFinal,
+                                  &Function::callValue, &Function::callInverse,
+                                  &Function::destroy);
+}
+
 #endif
@@ -2,6 +2,7 @@
 #define QS_CONNECTION_ASYNC_WORKER_H
 
 #include <functional>
+#include <memory>
 #include <utility>
 
 #include <QAtomicPointer>
@@ -15,6 +16,7 @@
 #include "qsconnection.h"
 #include "qsconnectionconfig.h"
 #include "qsconnectionworker.h"
+#include "qsuniquefunction.h"
 
 class QsWorkerThread;
 
@@ -31,11 +33,18 @@ public:
     using StmtTask    = QsConnectionWorker::StmtTask;
     using StmtTaskPtr = QsConnectionWorker::StmtTaskPtr;
 
+    using PreparedTask    = QsConnectionWorker::PreparedTask;
+    using PreparedTaskPtr = QsConnectionWorker::PreparedTaskPtr;
+
     using OnSuccess  = QsConnectionWorker::OnSuccess;
     using OnError    = QsConnectionWorker::OnError;
     using Handler    = QsConnectionWorker::Handler;
     using HandlerPtr = QsConnectionWorker::HandlerPtr;
 
+    template<typename T>
+    using OnBatchSuccess =
+        QsUniqueFunction<void (QVector<std::pair<T, int> > results)>;
+
     QsConnectionAsyncWorker(const QsConnectionConfig& config,
                             QObject*                  parent = nullptr);
 
@@ -90,6 +99,110 @@ public:
             bool        inTransaction = true,
             QVariant    data          = QVariant()) Q_DECL_NOTHROW;
 
+    // execute task for statement, registered in config by
+    // QsConnectionConfig::registerStatement (see PreparedTask)
+    std::pair<bool, QByteArray>
+    execute(PreparedTask task,
+            int          statementHandle,
+            OnSuccess    onSuccess,
+            OnError      onError              = OnError(),
+            bool         inTransaction        = true,
+            bool         handleInWorkerThread = false) Q_DECL_NOTHROW;
+
+    std::pair<bool, QByteArray>
+    execute(PreparedTaskPtr taskPtr,
+            int             statementHandle,
+            HandlerPtr      handlerPtr,
+            bool            inTransaction        = true,
+            bool            handleInWorkerThread = false) Q_DECL_NOTHROW;
+
+    std::pair<bool, QByteArray>
+    execute(PreparedTask task,
+            int          statementHandle,
+            bool         inTransaction = true,
+            QVariant     data          = QVariant()) Q_DECL_NOTHROW;
+
+    std::pair<bool, QByteArray>
+    execute(PreparedTaskPtr taskPtr,
+            int             statementHandle,
+            bool            inTransaction = true,
+            QVariant        data          = QVariant()) Q_DECL_NOTHROW;
+
+    // execute task for registered read-only statement with parameters
+    // and cache its result (see QsConnectionWorker::execCached)
+    std::pair<bool, QByteArray>
+    executeCached(PreparedTask task,
+                  int          statementHandle,
+                  QVariantList params,
+                  OnSuccess    onSuccess,
+                  OnError      onError              = OnError(),
+                  bool         handleInWorkerThread = false) Q_DECL_NOTHROW;
+
+    // read batch of values (see QsConnection::readBatch) in one task
+    template<typename T, typename Key>
+    std::pair<bool, QByteArray>
+    readBatch(QByteArray        query,
+              QVector<Key>      keys,
+              OnBatchSuccess<T> onSuccess,
+              OnError           onError              = OnError(),
+              bool              handleInWorkerThread = false) Q_DECL_NOTHROW;
+
+    template<typename Key>
+    inline std::pair<bool, QByteArray>
+    readDoubleBatch(QByteArray             query,
+                    QVector<Key>           keys,
+                    OnBatchSuccess<double> onSuccess,
+                    OnError                onError              = OnError(),
+                    bool                   handleInWorkerThread = false)
+    Q_DECL_NOTHROW
+    {
+        return readBatch<double>(std::move(query), std::move(keys),
+                                 std::move(onSuccess), std::move(onError),
+                                 handleInWorkerThread);
+    }
+
+    template<typename Key>
+    inline std::pair<bool, QByteArray>
+    readInt64Batch(QByteArray             query,
+                   QVector<Key>           keys,
+                   OnBatchSuccess<qint64> onSuccess,
+                   OnError                onError              = OnError(),
+                   bool                   handleInWorkerThread = false)
+    Q_DECL_NOTHROW
+    {
+        return readBatch<qint64>(std::move(query), std::move(keys),
+                                 std::move(onSuccess), std::move(onError),
+                                 handleInWorkerThread);
+    }
+
+    template<typename Key>
+    inline std::pair<bool, QByteArray>
+    readStringBatch(QByteArray                 query,
+                    QVector<Key>               keys,
+                    OnBatchSuccess<QByteArray> onSuccess,
+                    OnError                    onError = OnError(),
+                    bool                       handleInWorkerThread = false)
+    Q_DECL_NOTHROW
+    {
+        return readBatch<QByteArray>(std::move(query), std::move(keys),
+                                     std::move(onSuccess), std::move(onError),
+                                     handleInWorkerThread);
+    }
+
+    template<typename Key>
+    inline std::pair<bool, QByteArray>
+    readString16Batch(QByteArray              query,
+                      QVector<Key>            keys,
+                      OnBatchSuccess<QString> onSuccess,
+                      OnError                 onError = OnError(),
+                      bool                    handleInWorkerThread = false)
+    Q_DECL_NOTHROW
+    {
+        return readBatch<QString>(std::move(query), std::move(keys),
+                                  std::move(onSuccess), std::move(onError),
+                                  handleInWorkerThread);
+    }
+
     std::pair<bool, QByteArray>
     stop(unsigned long waitMilliseconds = 0) Q_DECL_NOTHROW;
 
@@ -111,33 +224,18 @@ signals:
     void finished(QVariant result,
                   QVariant helperData);
 
-    void execStmtWithDataSignal(StmtTaskPtr taskPtr,
-                                QByteArray  query,
-                                bool        inTransaction,
-                                QVariant    data,
-                                QPrivateSignal);
-
-    void execStmtWithHandlerSignal(StmtTaskPtr taskPtr,
-                                   QByteArray  query,
-                                   bool        inTransaction,
-                                   HandlerPtr  handlerPtr,
-                                   bool        runHandler,
-                                   QPrivateSignal);
-
-    void execWithDataSignal(TaskPtr  taskPtr,
-                            QVariant data,
-                            QPrivateSignal);
+    // row changes of committed transactions (see
+    // QsConnectionConfig::setNotifyRowChanges), so caches can be
+    // invalidated without polling of tables
+    void rowsChanged(QsConnection::RowChanges changes);
 
-    void execWithHandlerSignal(TaskPtr    taskPtr,
-                               HandlerPtr handlerPtr,
-                               bool       runHandler,
-                               QPrivateSignal);
+    // wake worker up for batch of queued jobs
+    void jobsQueued(QPrivateSignal);
 
 private slots:
 
-    void onExecuted(
-            QsConnectionWorker::ExecResultPtr resultPtr,
-            HandlerPtr                        handlerPtr) Q_DECL_NOTHROW;
+    // run handlers of batch of results in this object thread
+    void onResultsQueued() Q_DECL_NOTHROW;
 
     void onThreadFinished() Q_DECL_NOTHROW;
 
@@ -147,6 +245,7 @@ private:
     QMutex                           _mutex;
     QsConnectionConfig               _connectionConfig;
     QVector<QMetaObject::Connection> _workerObjConnections;
+    std::shared_ptr<qs::JobQueue>    _jobQueue;
 
     QByteArray checkWorkerThread() Q_DECL_NOTHROW;
 
@@ -158,8 +257,48 @@ private:
     disconnectWorkerObject(bool          quitThread,
                            unsigned long waitMilliseconds) Q_DECL_NOTHROW;
 
+    // move job into job queue of worker thread
+    std::pair<bool, QByteArray> submit(qs::Job& job) Q_DECL_NOTHROW;
+
+    static std::pair<bool, QByteArray> currentExceptionResult() Q_DECL_NOTHROW;
+
 };
 
+template<typename T, typename Key>
+std::pair<bool, QByteArray>
+QsConnectionAsyncWorker::readBatch(QByteArray        query,
+                                   QVector<Key>      keys,
+                                   OnBatchSuccess<T> onSuccess,
+                                   OnError           onError,
+                                   bool              handleInWorkerThread)
+Q_DECL_NOTHROW
+{
+    using Results = QVector<std::pair<T, int> >;
+
+    try {
+        // results are passed from task to handler by shared pointer
+        // (so whole batch is done by one task without QVariant conversion)
+        std::shared_ptr<Results> results = std::make_shared<Results>();
+
+        Task task = [results, query, keys] (QsConnection& connection) {
+            *results = connection.readBatch<T>(query, keys);
+            return QVariant();
+        };
+
+        OnSuccess handler = [results, onSuccess = std::move(onSuccess)] (
+                QVariant) {
+            if (onSuccess) {
+                onSuccess(std::move(*results));
+            }
+        };
+
+        return execute(std::move(task), std::move(handler),
+                       std::move(onError), handleInWorkerThread);
+    } catch (...) {
+        return currentExceptionResult();
+    }
+}
+
 // helper function for create pointer to Task, StmtTask and Handler
 
 inline QsConnectionAsyncWorker::TaskPtr
@@ -174,6 +313,12 @@ createStmtTask(QsConnectionWorker::StmtTask&& task)
     return std::make_shared<QsConnectionWorker::StmtTask>(std::move(task));
 }
 
+inline QsConnectionAsyncWorker::PreparedTaskPtr
+createPreparedTask(QsConnectionWorker::PreparedTask&& task)
+{
+    return std::make_shared<QsConnectionWorker::PreparedTask>(std::move(task));
+}
+
 inline QsConnectionAsyncWorker::HandlerPtr
 createHandler(QsConnectionAsyncWorker::OnSuccess&& onSuccess,
               QsConnectionAsyncWorker::OnError&&   onError)
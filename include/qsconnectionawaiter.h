@@ -0,0 +1,259 @@
+#ifndef QS_CONNECTION_AWAITER_H
+#define QS_CONNECTION_AWAITER_H
+
+// awaitable tasks of QsConnectionAsyncWorker for C++20 coroutines
+// (header defines nothing, if compiler does not support coroutines)
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define QS_COROUTINES_SUPPORTED
+#endif
+#endif
+
+#ifdef QS_COROUTINES_SUPPORTED
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+
+#include <QByteArray>
+#include <QVariant>
+
+#include "qsconnectionasyncworker.h"
+
+// awaiter, which executes task in worker thread and resumes coroutine with
+// task result (error message is not empty, if task fails);
+// coroutine is resumed in worker thread (so next task is queued to worker
+// directly after previous one) or in thread of QsConnectionAsyncWorker
+// object (usually thread, which started coroutine);
+// if worker is stopped before task result is handled, coroutine is not
+// resumed, but destroyed (its local objects are destroyed and frame is
+// freed in thread, which deletes not handled task)
+class QsTaskAwaiter
+{
+
+public:
+
+    using ExecResult = QsConnectionWorker::ExecResult;
+
+    enum ResumeMode {
+        ResumeInObjectThread = 0,
+        ResumeInWorkerThread
+    };
+
+    QsTaskAwaiter(QsConnectionAsyncWorker&      worker,
+                  QsConnectionAsyncWorker::Task task,
+                  ResumeMode                    resumeMode)
+        : _worker {&worker},
+          _resumeMode {resumeMode},
+          _task {std::move(task)}
+    {}
+
+    QsTaskAwaiter(QsConnectionAsyncWorker&          worker,
+                  QsConnectionAsyncWorker::StmtTask task,
+                  QByteArray                        query,
+                  bool                              inTransaction,
+                  ResumeMode                        resumeMode)
+        : _worker {&worker},
+          _resumeMode {resumeMode},
+          _inTransaction {inTransaction},
+          _stmtTask {std::move(task)},
+          _query {std::move(query)}
+    {}
+
+    QsTaskAwaiter(QsConnectionAsyncWorker&              worker,
+                  QsConnectionAsyncWorker::PreparedTask task,
+                  int                                   statementHandle,
+                  bool                                  inTransaction,
+                  ResumeMode                            resumeMode)
+        : _worker {&worker},
+          _resumeMode {resumeMode},
+          _inTransaction {inTransaction},
+          _statementHandle {statementHandle},
+          _preparedTask {std::move(task)}
+    {}
+
+    inline bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    // submit task (if submit fails, coroutine is not suspended)
+    bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+    {
+        // handlers capture awaiter, which lives in coroutine frame until
+        // coroutine is resumed, and shared guard of coroutine (so one
+        // Handler and one guard are allocated per task)
+        std::shared_ptr<Guard> guard;
+        try {
+            guard = std::make_shared<Guard>(coroutine);
+        } catch (...) {
+            _result.second = QsError(QsError::ExceptionError,
+                                     "Bad allocation exception!");
+            return false;
+        }
+
+        QsConnectionAsyncWorker::OnSuccess onSuccess =
+            [this, guard] (QVariant value) {
+                _result.first = std::move(value);
+                guard->release().resume();
+            };
+        QsConnectionAsyncWorker::OnError onError =
+            [this, guard] (QsError error) {
+                _result.second = std::move(error);
+                guard->release().resume();
+            };
+
+        std::pair<bool, QByteArray> result;
+        const bool inWorkerThread = _resumeMode == ResumeInWorkerThread;
+        if (_stmtTask) {
+            result = _worker->execute(std::move(_stmtTask), _query,
+                                      std::move(onSuccess),
+                                      std::move(onError),
+                                      _inTransaction, inWorkerThread);
+        } else if (_preparedTask) {
+            result = _worker->execute(std::move(_preparedTask),
+                                      _statementHandle,
+                                      std::move(onSuccess),
+                                      std::move(onError),
+                                      _inTransaction, inWorkerThread);
+        } else {
+            result = _worker->execute(std::move(_task),
+                                      std::move(onSuccess),
+                                      std::move(onError),
+                                      inWorkerThread);
+        }
+
+        // coroutine may be already resumed (or destroyed) in other thread,
+        // if task is submitted, so awaiter must not be used here in this
+        // case (rejected task is already deleted with its handlers)
+        if (!result.first) {
+            guard->release();
+            _result.second = QsError(std::move(result.second));
+        }
+
+        return result.first;
+    }
+
+    inline ExecResult await_resume() noexcept
+    {
+        return std::move(_result);
+    }
+
+private:
+
+    // owner of suspended coroutine: destroys coroutine, if handlers
+    // of task are deleted without call (worker is stopped)
+    class Guard
+    {
+
+    public:
+
+        explicit Guard(std::coroutine_handle<> coroutine) noexcept
+            : _coroutine {coroutine}
+        {}
+
+        ~Guard()
+        {
+            if (_coroutine) {
+                _coroutine.destroy();
+            }
+        }
+
+        inline std::coroutine_handle<> release() noexcept
+        {
+            return std::exchange(_coroutine, nullptr);
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator =(const Guard&) = delete;
+
+    private:
+
+        std::coroutine_handle<> _coroutine;
+
+    };
+
+    QsConnectionAsyncWorker*              _worker;
+    ResumeMode                            _resumeMode;
+    bool                                  _inTransaction   {true};
+    int                                   _statementHandle {-1};
+    QsConnectionAsyncWorker::Task         _task;
+    QsConnectionAsyncWorker::StmtTask     _stmtTask;
+    QsConnectionAsyncWorker::PreparedTask _preparedTask;
+    QByteArray                            _query;
+    ExecResult                            _result;
+
+};
+
+// helper functions for create awaiter, e.g.
+// auto result = co_await awaitExecute(worker, task);
+
+inline QsTaskAwaiter
+awaitExecute(QsConnectionAsyncWorker&      worker,
+             QsConnectionAsyncWorker::Task task,
+             QsTaskAwaiter::ResumeMode     resumeMode =
+                 QsTaskAwaiter::ResumeInObjectThread)
+{
+    return QsTaskAwaiter(worker, std::move(task), resumeMode);
+}
+
+inline QsTaskAwaiter
+awaitExecute(QsConnectionAsyncWorker&          worker,
+             QsConnectionAsyncWorker::StmtTask task,
+             QByteArray                        query,
+             bool                              inTransaction = true,
+             QsTaskAwaiter::ResumeMode         resumeMode =
+                 QsTaskAwaiter::ResumeInObjectThread)
+{
+    return QsTaskAwaiter(worker, std::move(task), std::move(query),
+                         inTransaction, resumeMode);
+}
+
+inline QsTaskAwaiter
+awaitExecute(QsConnectionAsyncWorker&              worker,
+             QsConnectionAsyncWorker::PreparedTask task,
+             int                                   statementHandle,
+             bool                                  inTransaction = true,
+             QsTaskAwaiter::ResumeMode             resumeMode =
+                 QsTaskAwaiter::ResumeInObjectThread)
+{
+    return QsTaskAwaiter(worker, std::move(task), statementHandle,
+                         inTransaction, resumeMode);
+}
+
+// coroutine type for fire-and-forget flows of awaited tasks: coroutine
+// starts immediately and frees its frame on completion
+// (exception, which escapes coroutine body, terminates program)
+struct QsDetachedCoroutine
+{
+    struct promise_type
+    {
+        inline QsDetachedCoroutine get_return_object() const noexcept
+        {
+            return QsDetachedCoroutine();
+        }
+
+        inline std::suspend_never initial_suspend() const noexcept
+        {
+            return std::suspend_never();
+        }
+
+        inline std::suspend_never final_suspend() const noexcept
+        {
+            return std::suspend_never();
+        }
+
+        inline void return_void() const noexcept
+        {}
+
+        inline void unhandled_exception() const noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+#endif
+
+#endif
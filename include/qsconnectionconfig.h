@@ -2,11 +2,15 @@
 #define QS_CONNECTION_CONFIG_H
 
 #include <QByteArray>
+#include <QByteArrayList>
 #include <QHash>
 #include <QLocale>
+#include <QMap>
 #include <QString>
+#include <QVector>
 
 #include "qsconnection.h"
+#include "qserror.h"
 
 class QsConnectionConfig
 {
@@ -21,7 +25,8 @@ public:
         OpenConnError = 1,
         CreateCollationError = 2,
         CreateSchemaError = 4,
-        ConfigureConnError = 8
+        ConfigureConnError = 8,
+        WarmUpError = 16
     };
 
     QsConnectionConfig(const QByteArray& dbName = QByteArray()) Q_DECL_NOTHROW;
@@ -32,43 +37,129 @@ public:
 
     ~QsConnectionConfig() noexcept = default;
 
+    // add script, which migrates schema from previous version to 'version'
+    // (versions are stored in PRAGMA user_version and must be greater than
+    // zero; create schema script is used as version 1, if it is not added);
+    // database with version 0 and non-empty schema is treated as version 1
+    // (created before migrations were used), and its version is saved
+    // on first writable open
+    void addMigration(int version, const QByteArray& script);
+
     void addUtf16Collator(const QByteArray& collationName,
                           const QLocale&    locale);
 
+    // add table or index, which pages are read into page cache
+    // after connection is opened
+    void addWarmUpObject(const QByteArray& name);
+
+    // add statement, which is compiled into connection statement cache
+    // after connection is opened
+    void addWarmUpStatement(const QByteArray& query);
+
+    int busyTimeout() const noexcept;
+
     QByteArray databaseName() const Q_DECL_NOTHROW;
 
+    void deleteMigration(int version);
+
     void deleteUtf16Collator(const QByteArray& collationName);
 
     QsConnection::CacheMode cacheMode() const noexcept;
 
+    int checkpointIdleTimeout() const noexcept;
+
+    int checkpointThreshold() const noexcept;
+
     QByteArray configConnectionScript() const Q_DECL_NOTHROW;
 
     QByteArray createSchemaScript() const Q_DECL_NOTHROW;
 
-    QByteArray lastError() const Q_DECL_NOTHROW;
+    QsConnection::Encoding encoding() const noexcept;
+
+    // messages of errors of last openAndConfig() (separated by space)
+    QByteArray lastError() const;
+
+    QMap<int, QByteArray> migrations() const;
 
     QString lastError16() const;
 
+    bool notifyRowChanges() const noexcept;
+
     QsConnection::OpenMode openMode() const noexcept;
 
+    qint64 resultCacheSize() const noexcept;
+
+    // return version of schema, which database has after migration
+    int schemaVersion() const noexcept;
+
     int  openAndConfig(QsConnection& connection);
 
     void setDatabaseName(const QByteArray& databaseName) Q_DECL_NOTHROW;
 
+    // register statement with unique name and return its handle
+    // (handles are indexes from 0; statement with registered name is
+    // replaced); statements must be registered before config is passed
+    // to worker, which compiles them once per connection
+    int registerStatement(const QByteArray& name, const QByteArray& query);
+
+    // set busy timeout (milliseconds) of connection (see
+    // QsConnection::setBusyTimeout); 0 disables waiting on lock conflicts
+    void setBusyTimeout(int milliseconds) noexcept;
+
     void setCacheMode(QsConnection::CacheMode value) noexcept;
 
+    // set time (milliseconds) without commits, after which worker
+    // truncates WAL (see setCheckpointThreshold)
+    void setCheckpointIdleTimeout(int milliseconds) noexcept;
+
+    // set count of WAL pages, after which worker runs passive checkpoint
+    // (in WAL mode) after queued tasks instead of automatic checkpoint
+    // on commit; 0 keeps automatic checkpoints of sqlite
+    void setCheckpointThreshold(int pages) noexcept;
+
     void setConfigConnectionScript(const QByteArray& script) Q_DECL_NOTHROW;
 
     void setCreateSchemaScript(const QByteArray& script) Q_DECL_NOTHROW;
 
+    // set text encoding of new database (it is set before schema is
+    // created; existing database keeps its encoding)
+    void setEncoding(QsConnection::Encoding value) noexcept;
+
+    // emit committed row changes of worker connection (see
+    // QsConnection::setRowChangeHandler and
+    // QsConnectionAsyncWorker::rowsChanged)
+    void setNotifyRowChanges(bool value) noexcept;
+
     void setOpenMode(QsConnection::OpenMode value) noexcept;
 
+    // set limit (bytes) of worker cache of task results for registered
+    // read-only statements (see QsConnectionWorker::execCached);
+    // 0 disables cache (default)
+    void setResultCacheSize(qint64 bytes) noexcept;
+
     void setThreadMode(QsConnection::ThreadMode value) noexcept;
 
+    // open (and warm up) connection, when worker thread starts,
+    // instead of opening it by first task
+    void setWarmUpOnStart(bool value) noexcept;
+
+    int statementCount() const noexcept;
+
+    // return handle of registered statement (or -1, if it is not found)
+    int statementHandle(const QByteArray& name) const noexcept;
+
+    QByteArray statementQuery(int handle) const;
+
     QsConnection::ThreadMode threadMode() const noexcept;
 
     QHash<QByteArray, QLocale> utf16Collators() const;
 
+    QByteArrayList warmUpObjects() const;
+
+    bool warmUpOnStart() const noexcept;
+
+    QByteArrayList warmUpStatements() const;
+
     QsConnectionConfig& operator =(const QsConnectionConfig& config) = default;
 
     QsConnectionConfig&
@@ -79,21 +170,38 @@ private:
     QsConnection::ThreadMode _threadMode;
     QsConnection::OpenMode   _openMode;
     QsConnection::CacheMode  _cacheMode;
+    QsConnection::Encoding   _encoding;
+    bool                     _warmUpOnStart;
+    bool                     _notifyRowChanges;
+    int                      _busyTimeout;
+    int                      _checkpointThreshold;
+    int                      _checkpointIdleTimeout;
+    qint64                   _resultCacheSize;
 
     QByteArray _databaseName;
     QByteArray _createSchemaScript;
     QByteArray _configConnectionScript;
-    QByteArray _lastError;
+
+    // errors of last openAndConfig()
+    QVector<QsError> _lastErrors;
 
     QHash<QByteArray, QLocale> _collatorLocales;
+    QMap<int, QByteArray>      _migrations;
+    QByteArrayList             _warmUpObjects;
+    QByteArrayList             _warmUpStatements;
+
+    // registered statements (name and query), indexed by handle
+    QVector<std::pair<QByteArray, QByteArray> > _statements;
+
+    QVector<QsError> createCollations(QsConnection& connection) const;
 
-    QByteArrayList createCollations(QsConnection& connection) const;
+    QsError migrateSchema(QsConnection& connection) const;
 
     bool tryConfigureConnection(QsConnection& connection) const noexcept;
 
     bool tryOpen(QsConnection& connection) const;
 
-    bool tryCreateSchema(QsConnection& connection) const noexcept;
+    QVector<QsError> warmUp(QsConnection& connection) const;
 
 };
 
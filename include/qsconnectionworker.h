@@ -1,9 +1,9 @@
 #ifndef QS_CONNECTION_WORKER_H
 #define QS_CONNECTION_WORKER_H
 
-#include <functional>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include <QByteArray>
 #include <QObject>
@@ -11,8 +11,16 @@
 
 #include "qsconnection.h"
 #include "qsconnectionconfig.h"
+#include "qserror.h"
 #include "qsstatement.h"
+#include "qsuniquefunction.h"
 
+class QTimer;
+
+namespace qs {
+struct Job;
+struct JobQueue;
+}
 
 class QsConnectionWorker : public QObject
 {
@@ -20,21 +28,38 @@ class QsConnectionWorker : public QObject
 
 public:
 
-    using Task          = std::function<QVariant (QsConnection& connection)>;
+    // tasks and handlers are move-only (see QsUniqueFunction)
+    using Task          = QsUniqueFunction<QVariant (QsConnection& connection)>;
     using TaskPtr       = std::shared_ptr<Task>;
 
-    using StmtTask    = std::function<QVariant (QsStatement statement,
-                                                bool&       commitChanges)>;
+    using StmtTask    = QsUniqueFunction<QVariant (QsStatement statement,
+                                                   bool&       commitChanges)>;
     using StmtTaskPtr = std::shared_ptr<StmtTask>;
 
-    using ExecResult    = std::pair<QVariant,QByteArray>;
-    using ExecResultPtr = std::shared_ptr<ExecResult>;
+    // task for statement, registered in config (statement is compiled once
+    // per connection, and it is reset after task)
+    using PreparedTask    = QsUniqueFunction<QVariant (
+                                const QsStatement& statement,
+                                bool&              commitChanges)>;
+    using PreparedTaskPtr = std::shared_ptr<PreparedTask>;
+
+    // error of failed task (see QsError; it is converted to message,
+    // if error handler takes QByteArray)
+    using ExecResult    = std::pair<QVariant,QsError>;
 
-    using OnSuccess       = std::function<void (QVariant   result)>;
-    using OnError         = std::function<void (QByteArray errorMessage)>;
+    using OnSuccess       = QsUniqueFunction<void (QVariant   result)>;
+    using OnError         = QsUniqueFunction<void (QsError error)>;
     using Handler         = std::pair<OnSuccess, OnError>;
     using HandlerPtr      = std::shared_ptr<Handler>;
 
+    // counters of result cache (see execCached)
+    struct ResultCacheStatistics {
+        qint64 hits    {0};
+        qint64 misses  {0};
+        qint64 bytes   {0};  // estimated size of cached results
+        int    entries {0};
+    };
+
 
     QsConnectionWorker(const QsConnectionConfig& config,
                        QObject*                  parent = nullptr);
@@ -42,10 +67,15 @@ public:
     QsConnectionWorker(QsConnectionConfig&& config,
                        QObject*             parent = nullptr);
 
-    virtual ~QsConnectionWorker() = default;
+    virtual ~QsConnectionWorker();
+
+    // drop cached task results (see execCached)
+    void clearResultCache() noexcept;
 
     inline void closeConnection() Q_DECL_NOTHROW
     {
+        clearResultCache();
+        _statements.clear();
         _connection.close();
     }
 
@@ -60,6 +90,25 @@ public:
                     const QByteArray&    query,
                     bool                 inTransaction = true) Q_DECL_NOTHROW;
 
+    ExecResult exec(const PreparedTask& task,
+                    int                 statementHandle,
+                    bool                inTransaction = true) Q_DECL_NOTHROW;
+
+    // execute task for registered read-only statement in read transaction,
+    // binding 'params' to statement before task (parameter i is bound
+    // to index i + 1, and count of params must match statement), and keep
+    // result in cache, if it is enabled by
+    // QsConnectionConfig::setResultCacheSize; same statement and
+    // parameters give cached result without running task, until tables,
+    // read by statement, are changed by worker connection, database is
+    // changed by other connection (see PRAGMA data_version) or schema is
+    // changed, so result of task must depend only on statement rows (and
+    // statement must not use functions like random()); results of
+    // statements, which read virtual tables or schema table, are not cached
+    ExecResult execCached(const PreparedTask& task,
+                          int                 statementHandle,
+                          const QVariantList& params) Q_DECL_NOTHROW;
+
     inline QByteArray lastError() const Q_DECL_NOTHROW
     {
         return _connectionConfig.lastError();
@@ -67,6 +116,12 @@ public:
 
     bool openConnection();
 
+    ResultCacheStatistics resultCacheStatistics() const noexcept;
+
+    // take jobs and send results through queue, shared with
+    // QsConnectionAsyncWorker (must be set before worker is moved to thread)
+    void setJobQueue(std::shared_ptr<qs::JobQueue> jobQueue) noexcept;
+
     QsConnectionWorker() = delete;
     QsConnectionWorker(const QsConnectionWorker&) = delete;
     QsConnectionWorker(QsConnectionWorker&&) = delete;
@@ -75,23 +130,13 @@ public:
 
 public slots:
 
-    void execWithHandler(TaskPtr    taskPtr,
-                         HandlerPtr handlerPtr,
-                         bool       runHandler) Q_DECL_NOTHROW;
-
-    void execWithData(TaskPtr  taskPtr,
-                      QVariant data) Q_DECL_NOTHROW;
-
-    void execStatementWithHandler(StmtTaskPtr stmtPtr,
-                                  QByteArray  query,
-                                  bool        inTransaction,
-                                  HandlerPtr  handlerPtr,
-                                  bool        runHandler) Q_DECL_NOTHROW;
+    // open connection (if it is closed), so it is configured and warmed up
+    // before first task (emit 'error' on fail)
+    void warmUp() Q_DECL_NOTHROW;
 
-    void execStatementWithData(StmtTaskPtr stmtPtr,
-                               QByteArray  query,
-                               bool        inTransaction,
-                               QVariant    data) Q_DECL_NOTHROW;
+    // execute batch of jobs from job queue (emit 'resultsQueued', if there
+    // are results, whose handlers must be run in thread of async worker)
+    void processJobs() Q_DECL_NOTHROW;
 
 signals:
 
@@ -100,24 +145,71 @@ signals:
     void errorWithData(QByteArray errorMessage,
                        QVariant   data);
 
-    void executed(ExecResultPtr resultPtr,
-                  HandlerPtr    handlerPtr);
-
     void finished(QVariant result,
                   QVariant data);
 
+    void resultsQueued();
+
+    // committed row changes (if they are enabled in config)
+    void rowsChanged(QsConnection::RowChanges changes);
+
 private:
 
     QsConnection       _connection;
     QsConnectionConfig _connectionConfig;
 
-    void processExecResultWithHandler(ExecResult& result,
-                                      HandlerPtr& handlerPtr,
-                                      const bool  runCallback) Q_DECL_NOTHROW;
+    // compiled registered statements, indexed by handle
+    std::vector<QsStatement> _statements;
+
+    // results of execCached (cache uses statements of connection, so it
+    // is declared after them and is cleared before connection is closed)
+    struct ResultCache;
+    std::unique_ptr<ResultCache> _resultCache;
+
+    // queue of jobs from QsConnectionAsyncWorker
+    std::shared_ptr<qs::JobQueue> _jobQueue;
+
+    // WAL checkpoint scheduling (see setCheckpointThreshold of config)
+    QTimer* _checkpointTimer;
+    bool    _checkpointScheduled;
+    bool    _walChanged;
+
+    // begin deferred transaction for read-only statement,
+    // otherwise begin immediate transaction
+    bool beginTransaction(const QsStatement& statement,
+                          ExecResult&        result) Q_DECL_NOTHROW;
+
+    void endTransaction(bool        commitChanges,
+                        ExecResult& result) Q_DECL_NOTHROW;
+
+    void checkpoint(QsConnection::CheckpointMode mode) Q_DECL_NOTHROW;
+
+    static int onWalCommit(void*       worker,
+                           sqlite3*    db,
+                           const char* schemaName,
+                           int         pages) Q_DECL_NOTHROW;
+
+    // error of opening and configuration of connection
+    QsError openError() const;
+
+    // emit committed row changes of connection
+    void flushRowChanges() Q_DECL_NOTHROW;
+
+    const QsStatement* preparedStatement(int statementHandle);
 
     void processExecResultWithData(ExecResult& result,
                                    QVariant&   data) Q_DECL_NOTHROW;
 
+    void tryRunPreparedTask(const PreparedTask& task,
+                            int                 statementHandle,
+                            ExecResult&         result,
+                            bool                inTransaction) Q_DECL_NOTHROW;
+
+    void tryRunCachedTask(const PreparedTask& task,
+                          int                 statementHandle,
+                          const QVariantList& params,
+                          ExecResult&         result) Q_DECL_NOTHROW;
+
     void tryRunStmtTask(const StmtTask&    stmtTask,
                         const QByteArray&  query,
                         ExecResult&        result,
@@ -128,9 +220,6 @@ private:
 
 };
 
-Q_DECLARE_METATYPE(QsConnectionWorker::TaskPtr)
-Q_DECLARE_METATYPE(QsConnectionWorker::StmtTaskPtr)
-Q_DECLARE_METATYPE(QsConnectionWorker::ExecResultPtr)
-Q_DECLARE_METATYPE(QsConnectionWorker::HandlerPtr)
+Q_DECLARE_METATYPE(QsConnection::RowChanges)
 
 #endif
@@ -0,0 +1,84 @@
+#ifndef QS_ERROR_H
+#define QS_ERROR_H
+
+#include <QByteArray>
+
+class QsConnection;
+
+// error of task execution: category, sqlite extended result code and
+// message, which is formatted on demand (context must be string literal,
+// details are saved only if sqlite error message is not generic),
+// so error can be checked by code without string allocation
+class QsError
+{
+
+public:
+
+    enum Category {
+        NoError = 0,
+        SqliteError,    // sqlite call failed (see code)
+        ConfigError,    // connection is not opened or configured
+        TaskError,      // task is empty or statement handle is unknown
+        ExceptionError, // exception is thrown by task
+        OtherError      // error is given by message only
+    };
+
+    QsError() noexcept;
+
+    // error with message only (empty message gives no error)
+    explicit QsError(const QByteArray& message);
+
+    QsError(Category          category,
+            const QByteArray& message,
+            int               code = 0);
+
+    QsError(Category    category,
+            const char* context,
+            int         code    = 0,
+            QByteArray  details = QByteArray()) noexcept;
+
+    // error of last sqlite call of connection
+    static QsError fromConnection(const char*         context,
+                                  const QsConnection& connection);
+
+    inline Category category() const noexcept
+    {
+        return _category;
+    }
+
+    // sqlite extended result code (or 0, if error is not sqlite error)
+    inline int code() const noexcept
+    {
+        return _code;
+    }
+
+    inline int primaryCode() const noexcept
+    {
+        return (_code > 0) ? (_code & 0xFF) : _code;
+    }
+
+    // check if database is busy or locked (so task can be retried)
+    bool isBusy() const noexcept;
+
+    inline bool isEmpty() const noexcept
+    {
+        return _category == NoError;
+    }
+
+    QByteArray message() const;
+
+    inline explicit operator QByteArray() const
+    {
+        return message();
+    }
+
+private:
+
+    Category    _category;
+    int         _code;
+    const char* _context;
+    QByteArray  _details;
+
+};
+
+#endif
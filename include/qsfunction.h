@@ -0,0 +1,267 @@
+#ifndef QS_FUNCTION_H
+#define QS_FUNCTION_H
+
+#include <exception>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "sqlite3.h"
+#include "qsvaluetraits.h"
+
+// helpers to register C++ callable objects as sqlite functions
+// (used by QsConnection::createFunction, createAggregateFunction
+// and createWindowFunction)
+
+namespace qs {
+
+namespace detail {
+
+// traits of callable object (lambda, functor or pointer to function)
+template<typename F>
+struct CallableTraits : CallableTraits<decltype(&F::operator())>
+{};
+
+template<typename R, typename... A>
+struct CallableTraits<R (*)(A...)>
+{
+    using Result = R;
+    using Args   = std::tuple<typename std::decay<A>::type...>;
+
+    enum { arity = sizeof...(A) };
+};
+
+template<typename C, typename R, typename... A>
+struct CallableTraits<R (C::*)(A...)> : CallableTraits<R (*)(A...)>
+{};
+
+template<typename C, typename R, typename... A>
+struct CallableTraits<R (C::*)(A...) const> : CallableTraits<R (*)(A...)>
+{};
+
+// call 'function' with prefix arguments and sqlite values, converted to types
+// from tuple 'Args' (starting from position 'Offset' of tuple)
+template<typename Args, std::size_t Offset,
+         typename F, std::size_t... I, typename... P>
+inline decltype(auto) invokeWithValues(F&                      function,
+                                       std::index_sequence<I...>,
+                                       sqlite3_value**         values,
+                                       P&...                   prefix)
+{
+    return function(prefix..., QsValueTraits<
+                    typename std::tuple_element<I + Offset, Args>::type>
+                    ::fromValue(values[I])...);
+}
+
+// set function result, returned by 'call', into sqlite context
+template<typename R>
+struct ResultSetter
+{
+    template<typename Call>
+    static inline void apply(sqlite3_context* context, Call&& call)
+    {
+        QsValueTraits<typename std::decay<R>::type>::toResult(context, call());
+    }
+};
+
+template<>
+struct ResultSetter<void>
+{
+    template<typename Call>
+    static inline void apply(sqlite3_context* context, Call&& call)
+    {
+        call();
+        sqlite3_result_null(context);
+    }
+};
+
+// run 'call' and convert exceptions into sqlite function errors
+template<typename Call>
+inline void runGuarded(sqlite3_context* context, Call&& call) noexcept
+{
+    try {
+        call();
+    } catch (const std::bad_alloc&) {
+        sqlite3_result_error_nomem(context);
+    } catch (const std::exception& exception) {
+        sqlite3_result_error(context, exception.what(), -1);
+    } catch (...) {
+        sqlite3_result_error(context, "Unknown exception!", -1);
+    }
+}
+
+template<typename F>
+struct ScalarFunction
+{
+    using Traits = CallableTraits<F>;
+
+    static void call(sqlite3_context* context,
+                     int,
+                     sqlite3_value**  values) noexcept
+    {
+        F& function = *static_cast<F*>(sqlite3_user_data(context));
+
+        runGuarded(context, [&] () {
+            ResultSetter<typename Traits::Result>::apply(context, [&] () {
+                return invokeWithValues<typename Traits::Args, 0>(
+                            function, std::make_index_sequence<Traits::arity>(),
+                            values);
+            });
+        });
+    }
+
+    static void destroy(void* function) noexcept
+    {
+        delete static_cast<F*>(function);
+    }
+};
+
+// aggregate state lives in sqlite aggregate context (zero-filled memory,
+// 8-byte aligned), constructed on first step and destroyed in final
+template<typename State>
+struct AggregateSlot
+{
+    bool constructed;
+    typename std::aligned_storage<sizeof(State), alignof(State)>::type storage;
+
+    static_assert(alignof(State) <= 8,
+                  "Aggregate state alignment must not exceed 8 bytes");
+
+    inline State& state() noexcept
+    {
+        return *reinterpret_cast<State*>(&storage);
+    }
+
+    static AggregateSlot* get(sqlite3_context* context, const bool create)
+    {
+        AggregateSlot* slot = static_cast<AggregateSlot*>(
+                    sqlite3_aggregate_context(context,
+                                              create ? sizeof(AggregateSlot)
+                                                     : 0));
+
+        // construct state, if memory is allocated first time
+        if (slot && !slot->constructed) {
+            new (&slot->storage) State();
+            slot->constructed = true;
+        }
+
+        return slot;
+    }
+
+    inline void destroy() noexcept
+    {
+        if (constructed) {
+            state().~State();
+            constructed = false;
+        }
+    }
+};
+
+template<typename State, typename Step, typename Final,
+         typename Inverse = std::nullptr_t, typename Value = std::nullptr_t>
+struct AggregateFunction
+{
+    using Slot        = AggregateSlot<State>;
+    using StepTraits  = CallableTraits<Step>;
+    using FinalTraits = CallableTraits<Final>;
+
+    enum { arity = StepTraits::arity - 1 };
+
+    Step    step;
+    Final   final;
+    Inverse inverse;
+    Value   value;
+
+    static void callStep(sqlite3_context* context,
+                         int,
+                         sqlite3_value**  values) noexcept
+    {
+        AggregateFunction* function = static_cast<AggregateFunction*>(
+                    sqlite3_user_data(context));
+        runStep(context, function->step, values);
+    }
+
+    static void callInverse(sqlite3_context* context,
+                            int,
+                            sqlite3_value**  values) noexcept
+    {
+        AggregateFunction* function = static_cast<AggregateFunction*>(
+                    sqlite3_user_data(context));
+        runStep(context, function->inverse, values);
+    }
+
+    static void callValue(sqlite3_context* context) noexcept
+    {
+        AggregateFunction* function = static_cast<AggregateFunction*>(
+                    sqlite3_user_data(context));
+
+        runGuarded(context, [&] () {
+            Slot* slot = Slot::get(context, true);
+            if (!slot) {
+                throw std::bad_alloc();
+            }
+
+            setResult<Value>(context, function->value, slot->state());
+        });
+    }
+
+    static void callFinal(sqlite3_context* context) noexcept
+    {
+        AggregateFunction* function = static_cast<AggregateFunction*>(
+                    sqlite3_user_data(context));
+
+        // if no rows was aggregated, state was not allocated by sqlite
+        Slot* slot = static_cast<Slot*>(sqlite3_aggregate_context(context, 0));
+        if (slot && slot->constructed) {
+            runGuarded(context, [&] () {
+                setResult<Final>(context, function->final, slot->state());
+            });
+            slot->destroy();
+        } else {
+            runGuarded(context, [&] () {
+                State state {};
+                setResult<Final>(context, function->final, state);
+            });
+        }
+    }
+
+    static void destroy(void* function) noexcept
+    {
+        delete static_cast<AggregateFunction*>(function);
+    }
+
+private:
+
+    template<typename F>
+    static inline void runStep(sqlite3_context* context,
+                               F&               step,
+                               sqlite3_value**  values) noexcept
+    {
+        runGuarded(context, [&] () {
+            Slot* slot = Slot::get(context, true);
+            if (!slot) {
+                throw std::bad_alloc();
+            }
+
+            State& state = slot->state();
+            invokeWithValues<typename CallableTraits<F>::Args, 1>(
+                        step, std::make_index_sequence<arity>(), values, state);
+        });
+    }
+
+    template<typename F>
+    static inline void setResult(sqlite3_context* context,
+                                 F&               function,
+                                 State&           state)
+    {
+        ResultSetter<typename CallableTraits<F>::Result>::apply(
+                    context, [&] () { return function(state); });
+    }
+};
+
+}
+
+}
+
+#endif
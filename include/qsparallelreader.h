@@ -0,0 +1,115 @@
+#ifndef QS_PARALLEL_READER_H
+#define QS_PARALLEL_READER_H
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QVariant>
+#include <QVector>
+
+#include "qsconnection.h"
+#include "qsconnectionasyncworker.h"
+#include "qsconnectionconfig.h"
+
+// scatter-gather scan of rowid (or other integer key) range: range is split
+// into parts, which are read concurrently by pool of read connections
+// (one QsConnectionAsyncWorker for each), and partial results are merged
+// in order of parts in thread of object;
+// readers of one scan see same WAL snapshot (first reader takes snapshot
+// and keeps its read transaction until other readers have opened it);
+// if database is not in WAL mode or sqlite is built without
+// SQLITE_ENABLE_SNAPSHOT, each reader reads in its own read transaction
+class QsParallelReader
+{
+
+public:
+
+    // inclusive range of keys
+    struct Range {
+        qint64 first;
+        qint64 last;
+    };
+
+    // read part of scan, e.g. run "select sum(v) from t where rowid
+    // between ?1 and ?2" with range bounds; task is called concurrently
+    // in worker threads (exception of task fails scan)
+    using RangeTask = std::function<QVariant (QsConnection& connection,
+                                              qint64        first,
+                                              qint64        last)>;
+
+    // merge partial result into result of previous parts
+    using Combine = std::function<QVariant (QVariant accumulated,
+                                            QVariant partial)>;
+
+    using OnSuccess = QsConnectionAsyncWorker::OnSuccess;
+    using OnError   = QsConnectionAsyncWorker::OnError;
+
+    // create pool of read connections with config (0 readers gives
+    // one reader for each CPU core); connections are opened by first scan
+    explicit QsParallelReader(const QsConnectionConfig& config,
+                              int                       readerCount = 0);
+
+    ~QsParallelReader() noexcept;
+
+    // read range of keys from first to last (inclusive) by up to
+    // readerCount() parts; 'combine' is called for partial results in order
+    // of parts (first partial result is initial value, empty range gives
+    // invalid value); without 'combine' result is QVariantList, which
+    // concatenates partial results (partial QVariantList is appended
+    // by items, other value is appended as item)
+    std::pair<bool, QByteArray>
+    execute(RangeTask task,
+            qint64    first,
+            qint64    last,
+            OnSuccess onSuccess,
+            OnError   onError = OnError(),
+            Combine   combine = Combine()) Q_DECL_NOTHROW;
+
+    // read range, given by first row of 'boundsQuery' in snapshot of scan,
+    // e.g. "select min(rowid), max(rowid) from t" (NULL bound gives empty
+    // range)
+    std::pair<bool, QByteArray>
+    execute(RangeTask  task,
+            QByteArray boundsQuery,
+            OnSuccess  onSuccess,
+            OnError    onError = OnError(),
+            Combine    combine = Combine()) Q_DECL_NOTHROW;
+
+    inline int readerCount() const noexcept
+    {
+        return static_cast<int>(_readers.size());
+    }
+
+    // split range into up to 'count' parts of nearly equal size
+    static QVector<Range> splitRange(qint64 first, qint64 last, int count);
+
+    // stop readers (running scans are cancelled)
+    std::pair<bool, QByteArray>
+    stop(unsigned long waitMilliseconds = 0) Q_DECL_NOTHROW;
+
+    QsParallelReader() = delete;
+    QsParallelReader(const QsParallelReader&) = delete;
+    QsParallelReader(QsParallelReader&&) = delete;
+    QsParallelReader& operator=(const QsParallelReader&) = delete;
+    QsParallelReader& operator=(QsParallelReader&&) = delete;
+
+private:
+
+    struct Scan;
+
+    std::vector<std::unique_ptr<QsConnectionAsyncWorker> > _readers;
+
+    // count of stop() calls (scan is cancelled, if it changes, so readers
+    // of stopped scan do not wait for each other)
+    std::shared_ptr<QAtomicInt> _stopCount;
+
+    std::pair<bool, QByteArray>
+    start(const std::shared_ptr<Scan>& scan) Q_DECL_NOTHROW;
+
+};
+
+#endif
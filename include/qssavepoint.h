@@ -0,0 +1,74 @@
+#ifndef QS_SAVEPOINT_H
+#define QS_SAVEPOINT_H
+
+#include "qsconnection.h"
+
+// RAII guard of nested transaction: begins savepoint on construction and
+// rolls it back on destruction, if it was not released by commit()
+// (guards must be destroyed in reverse order of construction)
+class QsSavepoint
+{
+
+public:
+
+    explicit QsSavepoint(QsConnection& connection) noexcept
+        : _connection {&connection},
+          _level {connection.beginSavepoint()}
+    {}
+
+    QsSavepoint(QsSavepoint&& savepoint) noexcept
+        : _connection {savepoint._connection},
+          _level {savepoint._level}
+    {
+        savepoint._level = 0;
+    }
+
+    ~QsSavepoint()
+    {
+        rollback();
+    }
+
+    // release savepoint, so its changes become part of outer transaction
+    // (or are committed, if there is no outer transaction)
+    inline bool commit() noexcept
+    {
+        if (_level && _connection->releaseSavepoint(_level)) {
+            _level = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    inline bool isActive() const noexcept
+    {
+        return _level != 0;
+    }
+
+    inline int level() const noexcept
+    {
+        return _level;
+    }
+
+    inline bool rollback() noexcept
+    {
+        if (_level && _connection->rollbackSavepoint(_level)) {
+            _level = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    QsSavepoint(const QsSavepoint&) = delete;
+    QsSavepoint& operator =(const QsSavepoint&) = delete;
+    QsSavepoint& operator =(QsSavepoint&&) = delete;
+
+private:
+
+    QsConnection* _connection;
+    int           _level;
+
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <QChar>
 #include <QPair>
 #include <QString>
+#include <QVector>
 
 class  QsConnection;
 struct sqlite3_stmt;
@@ -29,6 +30,53 @@ public:
         Undefined
     };
 
+    // node of query plan (row of EXPLAIN QUERY PLAN)
+    struct PlanNode {
+        int        parent;  // index of parent node in plan (-1 for top)
+        QByteArray detail;  // e.g. "SEARCH t USING INDEX t_a (a=?)"
+    };
+
+    // nodes of query plan tree (parent precedes its children)
+    using QueryPlan = QVector<PlanNode>;
+
+    // table, which is read by statement
+    struct TableName {
+        QByteArray database;  // e.g. "main"
+        QByteArray table;
+    };
+
+    using TableNames = QVector<TableName>;
+
+    // distinct values of columns, which are read by getByteArray and
+    // getString with interner while rows are iterated by next(): repeated
+    // value is found by raw bytes of column, so it is neither allocated
+    // nor decoded again, and identical values share one implicitly shared
+    // string (for columns with few distinct values); values are kept until
+    // interner is cleared or deleted
+    class Interner
+    {
+
+    public:
+
+        void clear() noexcept;
+
+    private:
+
+        friend class QsStatement;
+
+        // slot of open addressing table (index of value or -1)
+        struct Slot {
+            uint hash;
+            int  index;
+        };
+
+        QVector<Slot>       _byteArraySlots;
+        QVector<QByteArray> _byteArrays;
+        QVector<Slot>       _stringSlots;
+        QVector<QString>    _strings;
+
+    };
+
     QsStatement() noexcept;
 
     QsStatement(const QsConnection& connection,
@@ -41,6 +89,12 @@ public:
 
     ~QsStatement();
 
+    // decode text of column and append it to 'buffer', so text of many rows
+    // is decoded into one buffer without allocation for each row (if its
+    // capacity is reserved); return length of appended text
+    int appendString(int      index,
+                     QString& buffer) const;
+
     bool bindBlob(int         index,
                   const void* value,
                   int         bytes) const noexcept;
@@ -55,6 +109,13 @@ public:
     bool bindBlobCopy(int               index,
                       const QByteArray& value) const noexcept;
 
+    // bind blob without copy: statement keeps reference to implicitly
+    // shared data of value until parameter is bound by shared bind again,
+    // bindings are cleared or statement is deleted (so value may be
+    // temporary); raw data (see QByteArray::fromRawData) is not owned
+    bool bindBlobShared(int        index,
+                        QByteArray value) const;
+
     bool bindBool(int  index,
                   bool value) const noexcept;
 
@@ -89,13 +150,22 @@ public:
     bool bindText16Copy(int            index,
                         const QString& value) const noexcept;
 
+    // bind UTF-16 text without copy (see bindBlobShared)
+    bool bindText16Shared(int     index,
+                          QString value) const;
+
     bool bindTextCopy(int         index,
                       const char* value,
                       int         bytes = -1) const noexcept;
 
+    // bind copy of text (without transcoding in UTF-16 database)
     bool bindTextCopy(int            index,
                       const QString& value) const;
 
+    // bind UTF-8 text without copy (see bindBlobShared)
+    bool bindTextShared(int        index,
+                        QByteArray value) const;
+
     unsigned byteLength(int index) const noexcept;
 
     unsigned byteLength16(int index) const noexcept;
@@ -122,6 +192,10 @@ public:
 
     QByteArray getByteArray(int index) const;
 
+    // read value, shared with identical values of interner (see Interner)
+    QByteArray getByteArray(int       index,
+                            Interner& interner) const;
+
     QPair<const char*, int> getCStr(int index) const noexcept;
 
     QPair<const QChar*, int> getCStr16(int index) const noexcept;
@@ -136,8 +210,12 @@ public:
 
     qint64 getInt64(int index) const noexcept;
 
+    // read text as QString (without transcoding in UTF-16 database)
     QString getString(int index) const;
 
+    QString getString(int       index,
+                      Interner& interner) const;
+
     QString getString16(int index) const;
 
     bool isNull(int index) const noexcept;
@@ -157,14 +235,26 @@ public:
 
     bool next() const noexcept;
 
+    // read tables, which statement reads (tables of views are included);
+    // program of statement is compiled by EXPLAIN, so it is not for hot
+    // paths; return false on error or if statement reads virtual table
+    // or schema table (whose changes are not tracked by table)
+    bool readTables(TableNames& tables) const;
+
     bool recompile(const QByteArray& query) noexcept;
 
     bool recompile(const QString& query) noexcept;
 
     QByteArray query() const;
 
+    // return plan of statement (empty, if plan can not be read)
+    QueryPlan queryPlan() const;
+
     QString query16() const;
 
+    // reset statement, so it can be executed again (bindings are kept)
+    void rewind() const noexcept;
+
     Type type() const noexcept;
 
     QsStatement& operator =(QsStatement&& statement) noexcept;
@@ -176,13 +266,26 @@ private:
 
     sqlite3_stmt* _statement;
     sqlite3*      _db;
+    bool          _utf16;
+
+    // values of shared binds, indexed by parameter index - 1
+    mutable QVector<QByteArray> _sharedBytes;
+    mutable QVector<QString>    _sharedStrings;
 
     inline void reset() noexcept
     {
         _statement = NULL;
         _db = NULL;
+        _utf16 = false;
+        _sharedBytes.clear();
+        _sharedStrings.clear();
     }
 
+    // keep value of parameter alive and return pointer to its data
+    const char* keepShared(int index, QByteArray&& value) const;
+
+    const QChar* keepShared(int index, QString&& value) const;
+
     bool compile(const QByteArray& query) noexcept;
 
     bool compile(const QString& query) noexcept;
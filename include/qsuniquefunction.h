@@ -0,0 +1,241 @@
+#ifndef QS_UNIQUE_FUNCTION_H
+#define QS_UNIQUE_FUNCTION_H
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// move-only replacement of std::function for tasks and handlers: callable,
+// which fits into inline buffer (and is nothrow movable), is stored without
+// heap allocation; larger callable is allocated on heap
+template<typename Signature>
+class QsUniqueFunction;
+
+template<typename R, typename... Args>
+class QsUniqueFunction<R (Args...)>
+{
+
+    // callable type (other than QsUniqueFunction itself), whose result
+    // is convertible to R (so overloads with other signatures are not
+    // ambiguous, same as for std::function)
+    template<typename F, typename = void>
+    struct isCallable : std::false_type
+    {};
+
+    template<typename F>
+    struct isCallable<F, typename std::enable_if<
+            !std::is_same<F, QsUniqueFunction>::value
+            && (std::is_void<R>::value
+                || std::is_convertible<
+                    decltype(std::declval<F&>()(std::declval<Args>()...)),
+                    R>::value)>::type>
+        : std::true_type
+    {};
+
+public:
+
+    static constexpr std::size_t inlineSize = 6 * sizeof(void*);
+
+    QsUniqueFunction() noexcept
+        : _invoke {nullptr},
+          _manage {nullptr}
+    {}
+
+    QsUniqueFunction(std::nullptr_t) noexcept
+        : QsUniqueFunction()
+    {}
+
+    template<typename F,
+             typename = typename std::enable_if<
+                 isCallable<typename std::decay<F>::type>::value>::type>
+    QsUniqueFunction(F&& function)
+        : QsUniqueFunction()
+    {
+        using Callable = typename std::decay<F>::type;
+
+        // empty function pointer (or std::function) gives empty object
+        if (!isEmpty(function)) {
+            construct<Callable>(std::forward<F>(function),
+                                std::integral_constant<
+                                    bool, isInline<Callable>()>());
+        }
+    }
+
+    QsUniqueFunction(QsUniqueFunction&& function) noexcept
+        : QsUniqueFunction()
+    {
+        moveFrom(function);
+    }
+
+    ~QsUniqueFunction()
+    {
+        reset();
+    }
+
+    QsUniqueFunction& operator =(QsUniqueFunction&& function) noexcept
+    {
+        if (this != &function) {
+            reset();
+            moveFrom(function);
+        }
+
+        return *this;
+    }
+
+    QsUniqueFunction& operator =(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    template<typename F,
+             typename = typename std::enable_if<
+                 isCallable<typename std::decay<F>::type>::value>::type>
+    QsUniqueFunction& operator =(F&& function)
+    {
+        QsUniqueFunction(std::forward<F>(function)).swap(*this);
+        return *this;
+    }
+
+    // callable is invoked as non-const object (same as std::function)
+    R operator()(Args... args) const
+    {
+        if (!_invoke) {
+            throw std::bad_function_call();
+        }
+
+        return _invoke(_storage, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return _invoke != nullptr;
+    }
+
+    void swap(QsUniqueFunction& function) noexcept
+    {
+        QsUniqueFunction tmp(std::move(function));
+        function = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    QsUniqueFunction(const QsUniqueFunction&) = delete;
+    QsUniqueFunction& operator =(const QsUniqueFunction&) = delete;
+
+private:
+
+    union Storage
+    {
+        void* heap;
+        alignas(std::max_align_t) unsigned char buffer[inlineSize];
+    };
+
+    enum Operation {
+        MoveTo,
+        Destroy
+    };
+
+    using Invoker = R (*)(Storage& storage, Args&&... args);
+    using Manager = void (*)(Operation operation,
+                             Storage&  storage,
+                             Storage*  target) noexcept;
+
+    mutable Storage _storage;
+    Invoker         _invoke;
+    Manager         _manage;
+
+    template<typename Callable>
+    static constexpr bool isInline() noexcept
+    {
+        return sizeof(Callable) <= inlineSize
+                && alignof(Callable) <= alignof(std::max_align_t)
+                && std::is_nothrow_move_constructible<Callable>::value;
+    }
+
+    template<typename F>
+    static bool isEmpty(const F&) noexcept
+    {
+        return false;
+    }
+
+    template<typename T>
+    static bool isEmpty(T* const pointer) noexcept
+    {
+        return pointer == nullptr;
+    }
+
+    template<typename S>
+    static bool isEmpty(const std::function<S>& function) noexcept
+    {
+        return !function;
+    }
+
+    template<typename Callable, typename F>
+    void construct(F&& function, std::true_type)
+    {
+        ::new (static_cast<void*>(_storage.buffer))
+                Callable(std::forward<F>(function));
+
+        _invoke = [] (Storage& storage, Args&&... args) -> R {
+            return (*reinterpret_cast<Callable*>(storage.buffer))(
+                        std::forward<Args>(args)...);
+        };
+
+        _manage = [] (Operation operation,
+                      Storage&  storage,
+                      Storage*  target) noexcept {
+            Callable* callable = reinterpret_cast<Callable*>(storage.buffer);
+            if (operation == MoveTo) {
+                ::new (static_cast<void*>(target->buffer))
+                        Callable(std::move(*callable));
+            }
+            callable->~Callable();
+        };
+    }
+
+    template<typename Callable, typename F>
+    void construct(F&& function, std::false_type)
+    {
+        _storage.heap = new Callable(std::forward<F>(function));
+
+        _invoke = [] (Storage& storage, Args&&... args) -> R {
+            return (*static_cast<Callable*>(storage.heap))(
+                        std::forward<Args>(args)...);
+        };
+
+        _manage = [] (Operation operation,
+                      Storage&  storage,
+                      Storage*  target) noexcept {
+            if (operation == MoveTo) {
+                target->heap = storage.heap;
+            } else {
+                delete static_cast<Callable*>(storage.heap);
+            }
+        };
+    }
+
+    void moveFrom(QsUniqueFunction& function) noexcept
+    {
+        if (function._manage) {
+            function._manage(MoveTo, function._storage, &_storage);
+            _invoke = function._invoke;
+            _manage = function._manage;
+            function._invoke = nullptr;
+            function._manage = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if (_manage) {
+            _manage(Destroy, _storage, nullptr);
+            _invoke = nullptr;
+            _manage = nullptr;
+        }
+    }
+
+};
+
+#endif
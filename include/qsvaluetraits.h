@@ -0,0 +1,254 @@
+#ifndef QS_VALUE_TRAITS_H
+#define QS_VALUE_TRAITS_H
+
+#include <cstddef>
+
+#include <QByteArray>
+#include <QChar>
+#include <QString>
+
+#include "sqlite3.h"
+
+// QsValueTraits<T> maps C++ type T to sqlite values: it reads T from function
+// argument (fromValue) or result column (fromColumn), binds T to statement
+// parameter (bind), returns T as function result (toResult) and gives
+// declared sqlite type of column (typeName);
+// QByteArray is treated as UTF-8 text, QString as UTF-16 text
+template<typename T>
+struct QsValueTraits;
+
+template<>
+struct QsValueTraits<bool>
+{
+    static inline const char* typeName() noexcept
+    {
+        return "INTEGER";
+    }
+
+    static inline bool fromValue(sqlite3_value* value) noexcept
+    {
+        return sqlite3_value_int(value) != 0;
+    }
+
+    static inline bool fromColumn(sqlite3_stmt* stmt, const int index) noexcept
+    {
+        return sqlite3_column_int(stmt, index) != 0;
+    }
+
+    static inline int bind(sqlite3_stmt* stmt,
+                           const int     index,
+                           const bool    value) noexcept
+    {
+        return sqlite3_bind_int(stmt, index, value);
+    }
+
+    static inline void toResult(sqlite3_context* context,
+                                const bool       value) noexcept
+    {
+        sqlite3_result_int(context, value);
+    }
+};
+
+template<>
+struct QsValueTraits<int>
+{
+    static inline const char* typeName() noexcept
+    {
+        return "INTEGER";
+    }
+
+    static inline int fromValue(sqlite3_value* value) noexcept
+    {
+        return sqlite3_value_int(value);
+    }
+
+    static inline int fromColumn(sqlite3_stmt* stmt, const int index) noexcept
+    {
+        return sqlite3_column_int(stmt, index);
+    }
+
+    static inline int bind(sqlite3_stmt* stmt,
+                           const int     index,
+                           const int     value) noexcept
+    {
+        return sqlite3_bind_int(stmt, index, value);
+    }
+
+    static inline void toResult(sqlite3_context* context,
+                                const int        value) noexcept
+    {
+        sqlite3_result_int(context, value);
+    }
+};
+
+template<>
+struct QsValueTraits<qint64>
+{
+    static inline const char* typeName() noexcept
+    {
+        return "INTEGER";
+    }
+
+    static inline qint64 fromValue(sqlite3_value* value) noexcept
+    {
+        return sqlite3_value_int64(value);
+    }
+
+    static inline qint64 fromColumn(sqlite3_stmt* stmt,
+                                    const int     index) noexcept
+    {
+        return sqlite3_column_int64(stmt, index);
+    }
+
+    static inline int bind(sqlite3_stmt* stmt,
+                           const int     index,
+                           const qint64  value) noexcept
+    {
+        return sqlite3_bind_int64(stmt, index, value);
+    }
+
+    static inline void toResult(sqlite3_context* context,
+                                const qint64     value) noexcept
+    {
+        sqlite3_result_int64(context, value);
+    }
+};
+
+template<>
+struct QsValueTraits<double>
+{
+    static inline const char* typeName() noexcept
+    {
+        return "REAL";
+    }
+
+    static inline double fromValue(sqlite3_value* value) noexcept
+    {
+        return sqlite3_value_double(value);
+    }
+
+    static inline double fromColumn(sqlite3_stmt* stmt,
+                                    const int     index) noexcept
+    {
+        return sqlite3_column_double(stmt, index);
+    }
+
+    static inline int bind(sqlite3_stmt* stmt,
+                           const int     index,
+                           const double  value) noexcept
+    {
+        return sqlite3_bind_double(stmt, index, value);
+    }
+
+    static inline void toResult(sqlite3_context* context,
+                                const double     value) noexcept
+    {
+        sqlite3_result_double(context, value);
+    }
+};
+
+template<>
+struct QsValueTraits<QByteArray>
+{
+    static inline const char* typeName() noexcept
+    {
+        return "TEXT";
+    }
+
+    static inline QByteArray fromValue(sqlite3_value* value)
+    {
+        // get text before size (text conversion may change size)
+        const char* text = reinterpret_cast<const char*>(
+                    sqlite3_value_text(value));
+        return QByteArray(text, sqlite3_value_bytes(value));
+    }
+
+    static inline QByteArray fromColumn(sqlite3_stmt* stmt, const int index)
+    {
+        const char* text = reinterpret_cast<const char*>(
+                    sqlite3_column_text(stmt, index));
+        return QByteArray(text, sqlite3_column_bytes(stmt, index));
+    }
+
+    static inline int bind(sqlite3_stmt*     stmt,
+                           const int         index,
+                           const QByteArray& value) noexcept
+    {
+        return sqlite3_bind_text(stmt, index, value.constData(),
+                                 value.length(), SQLITE_TRANSIENT);
+    }
+
+    static inline void toResult(sqlite3_context*  context,
+                                const QByteArray& value) noexcept
+    {
+        sqlite3_result_text(context, value.constData(),
+                            value.length(), SQLITE_TRANSIENT);
+    }
+};
+
+template<>
+struct QsValueTraits<QString>
+{
+    static inline const char* typeName() noexcept
+    {
+        return "TEXT";
+    }
+
+    static inline QString fromValue(sqlite3_value* value)
+    {
+        const QChar* text = reinterpret_cast<const QChar*>(
+                    sqlite3_value_text16(value));
+        return QString(text, sqlite3_value_bytes16(value) / 2);
+    }
+
+    static inline QString fromColumn(sqlite3_stmt* stmt, const int index)
+    {
+        const QChar* text = reinterpret_cast<const QChar*>(
+                    sqlite3_column_text16(stmt, index));
+        return QString(text, sqlite3_column_bytes16(stmt, index) / 2);
+    }
+
+    static inline int bind(sqlite3_stmt*  stmt,
+                           const int      index,
+                           const QString& value) noexcept
+    {
+        return sqlite3_bind_text16(stmt, index, value.constData(),
+                                   value.length() << 1, SQLITE_TRANSIENT);
+    }
+
+    static inline void toResult(sqlite3_context* context,
+                                const QString&   value) noexcept
+    {
+        sqlite3_result_text16(context, value.constData(),
+                              value.length() << 1, SQLITE_TRANSIENT);
+    }
+};
+
+// types, which are supported for binding parameters only
+template<>
+struct QsValueTraits<const char*>
+{
+    static inline int bind(sqlite3_stmt*     stmt,
+                           const int         index,
+                           const char* const value) noexcept
+    {
+        return sqlite3_bind_text(stmt, index, value, -1, SQLITE_TRANSIENT);
+    }
+};
+
+template<>
+struct QsValueTraits<char*> : QsValueTraits<const char*>
+{};
+
+template<>
+struct QsValueTraits<std::nullptr_t>
+{
+    static inline int bind(sqlite3_stmt* stmt,
+                           const int     index,
+                           std::nullptr_t) noexcept
+    {
+        return sqlite3_bind_null(stmt, index);
+    }
+};
+
+#endif
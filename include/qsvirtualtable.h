@@ -0,0 +1,365 @@
+#ifndef QS_VIRTUAL_TABLE_H
+#define QS_VIRTUAL_TABLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+
+#include "sqlite3.h"
+#include "qsfunction.h"
+#include "qsvaluetraits.h"
+
+class QsConnection;
+
+namespace qs {
+namespace detail {
+
+// check if constraint value is converted to key type without loss and is
+// compared with keys of that type as sqlite compares it (with BINARY
+// collation), so range of keys can be found by binary search
+
+inline bool isExactInteger(sqlite3_value* value,
+                           const qint64   minimum,
+                           const qint64   maximum) noexcept
+{
+    qint64 integer;
+    switch (sqlite3_value_type(value)) {
+    case SQLITE_INTEGER:
+        integer = sqlite3_value_int64(value);
+        break;
+    case SQLITE_FLOAT: {
+        // integral value in range of qint64 (2^63 is out of range)
+        const double real = sqlite3_value_double(value);
+        if (real != std::trunc(real) || real < -9223372036854775808.0
+                || real >= 9223372036854775808.0) {
+            return false;
+        }
+        integer = static_cast<qint64>(real);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    return integer >= minimum && integer <= maximum;
+}
+
+template<typename T>
+inline bool isExactKey(sqlite3_value* value, const T*) noexcept
+{
+    return isExactInteger(value, std::numeric_limits<T>::min(),
+                          std::numeric_limits<T>::max());
+}
+
+inline bool isExactKey(sqlite3_value* value, const bool*) noexcept
+{
+    return isExactInteger(value, 0, 1);
+}
+
+inline bool isExactKey(sqlite3_value* value, const double*) noexcept
+{
+    // integer is compared with real by value (exact up to 2^53)
+    switch (sqlite3_value_type(value)) {
+    case SQLITE_FLOAT:
+        return true;
+    case SQLITE_INTEGER: {
+        const qint64 integer = sqlite3_value_int64(value);
+        const qint64 maximum = qint64(1) << 53;
+        return integer >= -maximum && integer <= maximum;
+    }
+    default:
+        return false;
+    }
+}
+
+inline bool isExactKey(sqlite3_value* value, const QByteArray*) noexcept
+{
+    return sqlite3_value_type(value) == SQLITE_TEXT;
+}
+
+inline bool isExactKey(sqlite3_value* value, const QString*) noexcept
+{
+    return sqlite3_value_type(value) == SQLITE_TEXT;
+}
+
+}
+}
+
+// base class of virtual table, exposed to sqlite by
+// QsConnection::createVirtualTable (rows are addressed by position,
+// key columns are addressed by position in ascending order of key)
+class QsVirtualTableBase
+{
+
+public:
+
+    friend class QsConnection;
+
+    QsVirtualTableBase() = default;
+
+    virtual ~QsVirtualTableBase() = default;
+
+    virtual int columnCount() const noexcept = 0;
+
+    virtual QByteArray columnName(int column) const = 0;
+
+    virtual const char* columnType(int column) const noexcept = 0;
+
+    QByteArray declaration() const;
+
+    // check if rows of key column can be found by value with keyBound
+    // (value has storage class of key and is converted without loss);
+    // otherwise all rows are passed to sqlite, which filters them
+    virtual bool isExactKey(int            column,
+                            sqlite3_value* value) const noexcept = 0;
+
+    virtual bool isKeyColumn(int column) const noexcept = 0;
+
+    // check if sqlite orders values of key column as keyRow does (text
+    // keys are not: sqlite compares them by bytes in database encoding
+    // and ORDER BY may use other collation); unordered keys are found
+    // only by equality
+    virtual bool isOrderedKeyColumn(int column) const noexcept = 0;
+
+    // return position (in key order) of first row, which key is not
+    // less than value (if 'upper' is false) or greater than value
+    virtual qint64 keyBound(int            column,
+                            sqlite3_value* value,
+                            bool           upper) const = 0;
+
+    // return row for position in key order
+    virtual qint64 keyRow(int    column,
+                          qint64 position) const noexcept = 0;
+
+    virtual void result(sqlite3_context* context,
+                        qint64           row,
+                        int              column) const = 0;
+
+    virtual qint64 rowCount() const noexcept = 0;
+
+    QsVirtualTableBase(const QsVirtualTableBase&) = delete;
+    QsVirtualTableBase& operator =(const QsVirtualTableBase&) = delete;
+
+private:
+
+    static const sqlite3_module* module(bool eponymousOnly) noexcept;
+
+};
+
+// virtual table over random access container of rows (std::vector, QVector);
+// columns are declared by addColumn with getter, which returns
+// bool, int, qint64, double, QByteArray or QString for row;
+// key columns support lookup and range scan by binary search (text keys
+// support lookup only; constraint with value of other type, inexact value
+// or collation other than BINARY gives scan of all rows); container must
+// not change, while table is registered
+template<typename Container>
+class QsVirtualTable : public QsVirtualTableBase
+{
+
+public:
+
+    using Row = typename Container::value_type;
+
+    explicit QsVirtualTable(std::shared_ptr<const Container> rows)
+        : _rows {std::move(rows)}
+    {}
+
+    template<typename Getter>
+    QsVirtualTable& addColumn(const QByteArray& name,
+                              Getter            getter,
+                              bool              isKey = false);
+
+    template<typename T>
+    QsVirtualTable& addColumn(const QByteArray& name,
+                              T Row::*          member,
+                              bool              isKey = false)
+    {
+        return addColumn(name, [member] (const Row& row) -> const T& {
+            return row.*member;
+        }, isKey);
+    }
+
+    int columnCount() const noexcept override
+    {
+        return static_cast<int>(_columns.size());
+    }
+
+    QByteArray columnName(const int column) const override
+    {
+        return _columns[column]->name;
+    }
+
+    const char* columnType(const int column) const noexcept override
+    {
+        return _columns[column]->type();
+    }
+
+    bool isExactKey(const int      column,
+                    sqlite3_value* value) const noexcept override
+    {
+        return _columns[column]->isExactKey(value);
+    }
+
+    bool isKeyColumn(const int column) const noexcept override
+    {
+        return _columns[column]->isKey;
+    }
+
+    bool isOrderedKeyColumn(const int column) const noexcept override
+    {
+        return _columns[column]->isKey && _columns[column]->isOrdered();
+    }
+
+    qint64 keyBound(const int      column,
+                    sqlite3_value* value,
+                    const bool     upper) const override
+    {
+        return _columns[column]->bound(*_rows, value, upper);
+    }
+
+    qint64 keyRow(const int column, const qint64 position) const noexcept
+    override
+    {
+        return _columns[column]->order[static_cast<size_t>(position)];
+    }
+
+    void result(sqlite3_context* context,
+                const qint64     row,
+                const int        column) const override
+    {
+        _columns[column]->result(context, (*_rows)[static_cast<size_t>(row)]);
+    }
+
+    qint64 rowCount() const noexcept override
+    {
+        return static_cast<qint64>(_rows->size());
+    }
+
+private:
+
+    struct ColumnBase
+    {
+        QByteArray          name;
+        std::vector<qint64> order;  // rows sorted by key (for key column)
+        bool                isKey {false};
+
+        virtual ~ColumnBase() = default;
+
+        virtual qint64 bound(const Container& rows,
+                             sqlite3_value*   value,
+                             bool             upper) const = 0;
+
+        virtual bool isExactKey(sqlite3_value* value) const noexcept = 0;
+
+        virtual bool isOrdered() const noexcept = 0;
+
+        virtual void result(sqlite3_context* context,
+                            const Row&       row) const = 0;
+
+        virtual const char* type() const noexcept = 0;
+    };
+
+    template<typename T, typename Getter>
+    struct Column : public ColumnBase
+    {
+        Getter getter;
+
+        explicit Column(Getter&& columnGetter)
+            : getter {std::move(columnGetter)}
+        {}
+
+        void buildOrder(const Container& rows)
+        {
+            this->order.resize(rows.size());
+            for (size_t i = 0; i < this->order.size(); ++i) {
+                this->order[i] = static_cast<qint64>(i);
+            }
+
+            std::stable_sort(this->order.begin(), this->order.end(),
+                             [this, &rows] (qint64 lhs, qint64 rhs) {
+                return getter(rows[static_cast<size_t>(lhs)])
+                        < getter(rows[static_cast<size_t>(rhs)]);
+            });
+        }
+
+        qint64 bound(const Container& rows,
+                     sqlite3_value*   value,
+                     const bool       upper) const override
+        {
+            const T key = QsValueTraits<T>::fromValue(value);
+            auto it = upper
+                    ? std::upper_bound(this->order.cbegin(),
+                                       this->order.cend(), key,
+                                       [this, &rows] (const T& k, qint64 row) {
+                        return k < getter(rows[static_cast<size_t>(row)]);
+                    })
+                    : std::lower_bound(this->order.cbegin(),
+                                       this->order.cend(), key,
+                                       [this, &rows] (qint64 row, const T& k) {
+                        return getter(rows[static_cast<size_t>(row)]) < k;
+                    });
+
+            return it - this->order.cbegin();
+        }
+
+        bool isExactKey(sqlite3_value* value) const noexcept override
+        {
+            return qs::detail::isExactKey(value,
+                                          static_cast<const T*>(nullptr));
+        }
+
+        bool isOrdered() const noexcept override
+        {
+            return !std::is_same<T, QByteArray>::value
+                    && !std::is_same<T, QString>::value;
+        }
+
+        void result(sqlite3_context* context, const Row& row) const override
+        {
+            QsValueTraits<T>::toResult(context, getter(row));
+        }
+
+        const char* type() const noexcept override
+        {
+            return QsValueTraits<T>::typeName();
+        }
+    };
+
+    std::shared_ptr<const Container>         _rows;
+    std::vector<std::unique_ptr<ColumnBase> > _columns;
+
+};
+
+template<typename Container>
+template<typename Getter>
+QsVirtualTable<Container>&
+QsVirtualTable<Container>::addColumn(const QByteArray& name,
+                                     Getter            getter,
+                                     const bool        isKey)
+{
+    using T = typename std::decay<
+        typename qs::detail::CallableTraits<Getter>::Result>::type;
+
+    std::unique_ptr<Column<T, Getter> > column =
+            std::make_unique<Column<T, Getter> >(std::move(getter));
+    column->name = name;
+    column->isKey = isKey;
+
+    // build order of rows, sorted by key (rows are not changed later)
+    if (isKey) {
+        column->buildOrder(*_rows);
+    }
+
+    _columns.push_back(std::move(column));
+    return *this;
+}
+
+#endif
@@ -0,0 +1,177 @@
+#include "qsbloomfilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// bits per expected key and count of bits per key, which give about 1%
+// of false positives
+constexpr qint64 bitsPerKey = 10;
+constexpr int    hashCount  = 7;
+
+constexpr quint64 fnvOffset = 14695981039346656037ULL;
+constexpr quint64 fnvPrime  = 1099511628211ULL;
+
+inline quint64 fnvAppend(quint64 hash, const unsigned char byte) noexcept
+{
+    return (hash ^ byte) * fnvPrime;
+}
+
+// finalizer of splitmix64 (spreads bits of FNV hash)
+inline quint64 mix(quint64 hash) noexcept
+{
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+}
+
+void qs::BloomFilter::reset(const qint64 expectedKeys)
+{
+    // round count of bits up to power of 2, so position is taken by mask
+    const qint64 bits = std::max<qint64>(expectedKeys, 64) * bitsPerKey;
+    qint64 words = 1;
+    while (words * 64 < bits) {
+        words *= 2;
+    }
+
+    _words.fill(0, static_cast<int>(words));
+    _mask = static_cast<quint64>(words) * 64 - 1;
+    _setBits = 0;
+    _keyCount = 0;
+}
+
+void qs::BloomFilter::add(const quint64 hash) noexcept
+{
+    if (_words.isEmpty()) {
+        return;
+    }
+
+    quint64* words = _words.data();
+    const quint64 step = (hash >> 32) | 1;
+    quint64 position = hash;
+    for (int i = 0; i < hashCount; ++i, position += step) {
+        const quint64 bit = position & _mask;
+        quint64& word = words[bit >> 6];
+        const quint64 flag = quint64(1) << (bit & 63);
+        if (!(word & flag)) {
+            word |= flag;
+            ++_setBits;
+        }
+    }
+
+    ++_keyCount;
+}
+
+bool qs::BloomFilter::mayContain(const quint64 hash) const noexcept
+{
+    if (_words.isEmpty()) {
+        return true;
+    }
+
+    const quint64* words = _words.constData();
+    const quint64 step = (hash >> 32) | 1;
+    quint64 position = hash;
+    for (int i = 0; i < hashCount; ++i, position += step) {
+        const quint64 bit = position & _mask;
+        if (!(words[bit >> 6] & (quint64(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+double qs::BloomFilter::saturation() const noexcept
+{
+    return _words.isEmpty() ? 1.0 : double(_setBits) / double(_mask + 1);
+}
+
+double qs::BloomFilter::falsePositiveRate() const noexcept
+{
+    return std::pow(saturation(), hashCount);
+}
+
+quint64 qs::BloomFilter::hashInt(const qint64 value) noexcept
+{
+    // hash decimal digits from the last one (without formatting of text)
+    char digits[20];
+    int count = 0;
+    quint64 rest = (value < 0) ? 0 - static_cast<quint64>(value)
+                               : static_cast<quint64>(value);
+    do {
+        digits[count++] = static_cast<char>('0' + rest % 10);
+        rest /= 10;
+    } while (rest);
+
+    quint64 hash = fnvOffset;
+    if (value < 0) {
+        hash = fnvAppend(hash, '-');
+    }
+    while (count > 0) {
+        hash = fnvAppend(hash, static_cast<unsigned char>(digits[--count]));
+    }
+
+    return mix(hash);
+}
+
+quint64 qs::BloomFilter::hashDouble(const double value) noexcept
+{
+    // real number, which equals integer, matches integer key
+    if (value == std::floor(value) && std::fabs(value) < 9.0e18) {
+        return hashInt(static_cast<qint64>(value));
+    }
+
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return mix(bits ^ fnvOffset);
+}
+
+quint64 qs::BloomFilter::hashBytes(const void* const data,
+                                   const int         bytes) noexcept
+{
+    const unsigned char* in = static_cast<const unsigned char*>(data);
+    quint64 hash = fnvOffset;
+    for (int i = 0; i < bytes; ++i) {
+        hash = fnvAppend(hash, in[i]);
+    }
+
+    return mix(hash);
+}
+
+quint64 qs::BloomFilter::hashUtf16(const QChar* const data,
+                                   const int          length) noexcept
+{
+    // hash UTF-8 bytes of text without conversion
+    quint64 hash = fnvOffset;
+    for (int i = 0; i < length; ++i) {
+        unsigned code = data[i].unicode();
+        if (code >= 0xD800 && code < 0xDC00 && i + 1 < length
+                && data[i + 1].unicode() >= 0xDC00
+                && data[i + 1].unicode() < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10)
+                    + (data[++i].unicode() - 0xDC00);
+        }
+
+        if (code < 0x80) {
+            hash = fnvAppend(hash, code);
+        } else if (code < 0x800) {
+            hash = fnvAppend(hash, 0xC0 | (code >> 6));
+            hash = fnvAppend(hash, 0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            hash = fnvAppend(hash, 0xE0 | (code >> 12));
+            hash = fnvAppend(hash, 0x80 | ((code >> 6) & 0x3F));
+            hash = fnvAppend(hash, 0x80 | (code & 0x3F));
+        } else {
+            hash = fnvAppend(hash, 0xF0 | (code >> 18));
+            hash = fnvAppend(hash, 0x80 | ((code >> 12) & 0x3F));
+            hash = fnvAppend(hash, 0x80 | ((code >> 6) & 0x3F));
+            hash = fnvAppend(hash, 0x80 | (code & 0x3F));
+        }
+    }
+
+    return mix(hash);
+}
@@ -0,0 +1,60 @@
+#ifndef QS_BLOOM_FILTER_H
+#define QS_BLOOM_FILTER_H
+
+#include <QChar>
+#include <QVector>
+#include <QtGlobal>
+
+
+namespace qs {
+
+// Bloom filter of 64-bit key hashes (bit positions are derived from one
+// hash by double hashing); keys can not be removed, so filter only
+// saturates, while keys are added
+class BloomFilter
+{
+
+public:
+
+    // allocate filter for 'expectedKeys' (about 1% of false positives,
+    // while count of added keys does not exceed it)
+    void reset(qint64 expectedKeys);
+
+    void add(quint64 hash) noexcept;
+
+    bool mayContain(quint64 hash) const noexcept;
+
+    inline qint64 keyCount() const noexcept
+    {
+        return _keyCount;
+    }
+
+    // part of set bits
+    double saturation() const noexcept;
+
+    // estimated probability of false positive for missing key
+    double falsePositiveRate() const noexcept;
+
+    // hashes of key values: integer is hashed as its decimal text (so it
+    // matches the same number, stored as text), real number with integer
+    // value is hashed as integer, text is hashed as UTF-8
+    static quint64 hashInt(qint64 value) noexcept;
+
+    static quint64 hashDouble(double value) noexcept;
+
+    static quint64 hashBytes(const void* data, int bytes) noexcept;
+
+    static quint64 hashUtf16(const QChar* data, int length) noexcept;
+
+private:
+
+    QVector<quint64> _words;
+    quint64          _mask     {0};  // count of bits - 1 (power of 2)
+    qint64           _setBits  {0};
+    qint64           _keyCount {0};
+
+};
+
+}
+
+#endif
@@ -1,13 +1,275 @@
 #include "../include/qsconnection.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <atomic>
+#include <limits>
+#include <random>
+#include <thread>
 
 #include <QReadLocker>
+#include <QSet>
 #include <QWriteLocker>
 
 #include "../include/sqlite3.h"
 #include "../include/qsstatement.h"
+#include "qsbloomfilter.h"
+#include "qshelper.h"
+
+struct QsConnection::BusyHandler
+{
+    int            timeout;      // max waiting time of conflict (ms)
+    int            maxDelay;     // max delay between retries (ms)
+    qint64         conflictWait; // waiting time of current conflict (us)
+    BusyStatistics statistics;
+    std::minstd_rand random;
+
+    // sqlite busy handler (return 0 to stop retrying)
+    static int call(void* handler, int count) noexcept;
+};
+
+struct QsConnection::PlanChecker
+{
+    bool                enabled;
+    PlanCheckHandler    handler;
+    PlanCheckStatistics statistics;
+    QSet<QByteArray>    checkedQueries;
+
+    // schema version of checked queries (plan of query may be changed
+    // by schema change, e.g. by new index)
+    sqlite3_stmt*       schemaVersionStmt {NULL};
+    int                 schemaVersion     {-1};
+};
+
+namespace {
+
+// add value of first column to filter (hash matches keyHash of key)
+void addColumnKey(qs::BloomFilter& bloom, sqlite3_stmt* const stmt) noexcept
+{
+    switch (sqlite3_column_type(stmt, 0)) {
+    case SQLITE_INTEGER:
+        bloom.add(qs::BloomFilter::hashInt(sqlite3_column_int64(stmt, 0)));
+        break;
+    case SQLITE_FLOAT:
+        bloom.add(qs::BloomFilter::hashDouble(
+                      sqlite3_column_double(stmt, 0)));
+        break;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB: {
+        // text is read as UTF-8 (also in UTF-16 database)
+        const void* data = (sqlite3_column_type(stmt, 0) == SQLITE_TEXT)
+                ? static_cast<const void*>(sqlite3_column_text(stmt, 0))
+                : sqlite3_column_blob(stmt, 0);
+        bloom.add(qs::BloomFilter::hashBytes(data,
+                                             sqlite3_column_bytes(stmt, 0)));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// replace 'name' by first column of query with 'name' bound to ?1, e.g.
+// by name of table, as it is written in schema (return false, if query
+// fails or gives no row)
+bool readCanonicalName(sqlite3* const    db,
+                       const QByteArray& query,
+                       QByteArray&       name)
+{
+    sqlite3_stmt* stmt = NULL;
+    if (qs::blockingPrepare(db, query.constData(), query.length(), 0, &stmt)
+            != SQLITE_OK || !stmt) {
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, name.constData(), name.length(),
+                      SQLITE_TRANSIENT);
+    const bool found = qs::blockingStep(stmt) == SQLITE_ROW;
+    if (found) {
+        name = QByteArray(reinterpret_cast<const char*>(
+                              sqlite3_column_text(stmt, 0)));
+    }
+    sqlite3_finalize(stmt);
+
+    return found;
+}
+
+}
+
+struct QsConnection::KeyFilter
+{
+    QByteArray      database;
+    QByteArray      table;
+    QByteArray      column;
+    qs::BloomFilter bloom;
+    sqlite3_stmt*   keyStatement {NULL};  // reads key of row by rowid
+    QVector<qint64> changedRowIds;        // rows, whose keys are not added
+    bool            valid        {false}; // false, if change is lost
+    qint64          skippedCount {0};
+    qint64          passedCount  {0};
+
+    ~KeyFilter()
+    {
+        sqlite3_finalize(keyStatement);
+    }
+};
+
+struct QsConnection::RowChangeTracker
+{
+    RowChangeHandler handler;
+    RowChanges       pending;    // changes of current transaction
+    RowChanges       committed;  // changes of committed transactions
+    RowChanges       delivered;  // buffer, reused by flushRowChanges()
+
+    // names of changed tables (so change does not allocate name)
+    QVector<QByteArray> names;
+
+    // count of changes of connection, when untracked changes were checked
+    // last time, and count of changes, seen by update hook since then
+    int totalChanges {0};
+    int hookChanges  {0};
+
+    // key filters, indexed by handle (see addKeyFilter)
+    std::vector<std::unique_ptr<KeyFilter> > keyFilters;
+
+    QByteArray name(const char* name);
+
+    static void onUpdate(void*         tracker,
+                         int           operation,
+                         const char*   database,
+                         const char*   table,
+                         sqlite3_int64 rowId) noexcept;
+
+    static int onCommit(void* tracker) noexcept;
+
+    static void onRollback(void* tracker) noexcept;
+};
+
+QByteArray QsConnection::RowChangeTracker::name(const char* const name)
+{
+    for (const QByteArray& known : names) {
+        if (std::strcmp(known.constData(), name) == 0) {
+            return known;
+        }
+    }
+
+    names.append(QByteArray(name));
+    return names.last();
+}
+
+void QsConnection::RowChangeTracker::onUpdate(void* const         tracker,
+                                              const int           operation,
+                                              const char* const   database,
+                                              const char* const   table,
+                                              const sqlite3_int64 rowId)
+noexcept
+{
+    RowChangeTracker* self = static_cast<RowChangeTracker*>(tracker);
+    ++self->hookChanges;
+
+    // keys of inserted and updated rows are read later (statements can
+    // not run in hook); filter, which loses row, is turned off
+    if (operation != SQLITE_DELETE) {
+        for (const std::unique_ptr<KeyFilter>& filter : self->keyFilters) {
+            if (filter && filter->valid
+                    && std::strcmp(filter->table.constData(), table) == 0
+                    && std::strcmp(filter->database.constData(),
+                                   database) == 0) {
+                try {
+                    filter->changedRowIds.append(rowId);
+                } catch (...) {
+                    filter->valid = false;
+                }
+            }
+        }
+    }
+
+    if (!self->handler) {
+        return;
+    }
+
+    const RowOperation rowOperation =
+            (operation == SQLITE_INSERT) ? RowInserted
+                                         : (operation == SQLITE_DELETE)
+                                           ? RowDeleted : RowUpdated;
+
+    // change, which can not be saved, is lost (hook can not report error)
+    try {
+        self->pending.append(RowChange {self->name(database),
+                                        self->name(table),
+                                        rowId, rowOperation});
+    } catch (...) {
+        return;
+    }
+}
+
+int QsConnection::RowChangeTracker::onCommit(void* const tracker) noexcept
+{
+    RowChangeTracker* self = static_cast<RowChangeTracker*>(tracker);
+
+    // move changes of transaction to committed changes
+    try {
+        if (self->committed.isEmpty()) {
+            self->committed.swap(self->pending);
+        } else {
+            self->committed += self->pending;
+        }
+    } catch (...) {
+        self->pending.clear();
+        return 0;
+    }
+
+    self->pending.clear();
+
+    // return 0, so commit is not turned into rollback
+    return 0;
+}
+
+void QsConnection::RowChangeTracker::onRollback(void* const tracker) noexcept
+{
+    static_cast<RowChangeTracker*>(tracker)->pending.clear();
+}
+
+int QsConnection::BusyHandler::call(void* handler, const int count) noexcept
+{
+    using namespace std::chrono;
+
+    BusyHandler* busy = static_cast<BusyHandler*>(handler);
+
+    // first call is the beginning of new lock conflict
+    if (count == 0) {
+        ++busy->statistics.busyCount;
+        busy->conflictWait = 0;
+    }
+
+    // check if waiting time is over
+    const qint64 remaining = busy->timeout * 1000LL - busy->conflictWait;
+    if (remaining <= 0) {
+        ++busy->statistics.timeoutCount;
+        return 0;
+    }
+
+    // delay is doubled on each retry and randomized in range [delay/2, delay]
+    // (so waiting connections do not retry at the same time)
+    qint64 delay = std::min(busy->maxDelay * 1000LL,
+                            1000LL << std::min(count, 20));
+    delay = delay / 2 + static_cast<qint64>(busy->random() % (delay / 2 + 1));
+    delay = std::min(delay, remaining);
+
+    // sleep and save real waiting time
+    const steady_clock::time_point start = steady_clock::now();
+    std::this_thread::sleep_for(microseconds(delay));
+    const qint64 waited = duration_cast<microseconds>(
+                steady_clock::now() - start).count();
+
+    busy->conflictWait += waited;
+    busy->statistics.waitTime += waited;
+    ++busy->statistics.retryCount;
+
+    return 1;
+}
 
 namespace {
 
@@ -56,6 +318,48 @@ int getOpenFlags(const QsConnection::OpenMode   openMode,
     return resFlags;
 }
 
+// function return sqlite flags for QsConnection::FunctionFlag combination
+int getFunctionFlags(const int flags) noexcept
+{
+    int resFlags = SQLITE_UTF8;
+
+    if (flags & QsConnection::FunctionFlag::Deterministic) {
+        resFlags |= SQLITE_DETERMINISTIC;
+    }
+
+    if (flags & QsConnection::FunctionFlag::Innocuous) {
+        resFlags |= SQLITE_INNOCUOUS;
+    }
+
+    if (flags & QsConnection::FunctionFlag::DirectOnly) {
+        resFlags |= SQLITE_DIRECTONLY;
+    }
+
+    return resFlags;
+}
+
+// function return schema name for sqlite API ("main" for empty name)
+inline const char* schemaNameOf(const QByteArray& schemaName) noexcept
+{
+    return schemaName.isEmpty() ? "main" : schemaName.constData();
+}
+
+// queries of transaction control statements (QsConnection::ControlStatement)
+const char* const controlQueries[] = {
+    "begin deferred",
+    "begin immediate",
+    "begin exclusive",
+    "commit",
+    "rollback"
+};
+
+// formats of savepoint statements (QsConnection::SavepointStatement)
+const char* const savepointFormats[] = {
+    "savepoint qs_savepoint_%d",
+    "release qs_savepoint_%d",
+    "rollback to qs_savepoint_%d"
+};
+
 // function to compare UTF16 string by locale
 // (collator is a pointer to some QCollator object)
 int localeCompareUtf16(void* collator,
@@ -78,19 +382,40 @@ using StringResult   = std::pair<QByteArray, int>;
 using String16Result = std::pair<QString,    int>;
 
 using CollatorContainer = QHash<QByteArray, std::shared_ptr<QCollator> >;
+using ImageContainer    = QHash<QByteArray, QByteArray>;
 
 
 QsConnection::QsConnection(const QByteArray& dbName) Q_DECL_NOTHROW
     : _db {NULL},
-      _dbName {dbName}
+      _dbName {dbName},
+      _encoding {Utf8},
+      _encodingKnown {false},
+      _statementCacheSize {defaultStatementCacheSize},
+      _statementUse {0},
+      _controlStatements {},
+      _savepointLevel {0}
 {}
 
 QsConnection::QsConnection(QsConnection&& connection) Q_DECL_NOTHROW
     : _db {connection._db},
       _dbName {std::move(connection._dbName)},
       _openErrorMsg {std::move(connection._openErrorMsg)},
-      _collators {std::move(connection._collators)}
+      _encoding {connection._encoding},
+      _encodingKnown {connection._encodingKnown},
+      _collators {std::move(connection._collators)},
+      _images {std::move(connection._images)},
+      _statementCache {std::move(connection._statementCache)},
+      _statementCacheSize {connection._statementCacheSize},
+      _statementUse {connection._statementUse}
 {
+    std::copy(std::begin(connection._controlStatements),
+              std::end(connection._controlStatements),
+              std::begin(_controlStatements));
+    _savepointStatements = std::move(connection._savepointStatements);
+    _savepointLevel = connection._savepointLevel;
+    _busyHandler = std::move(connection._busyHandler);
+    _planChecker = std::move(connection._planChecker);
+    _rowChangeTracker = std::move(connection._rowChangeTracker);
     connection.reset();
 }
 
@@ -99,23 +424,181 @@ QsConnection::~QsConnection()
     close();
 }
 
+int QsConnection::addKeyFilter(const QByteArray& table,
+                               const QByteArray& column,
+                               const qint64      expectedKeys,
+                               const QByteArray& database)
+{
+    // check connection
+    if (!_db) {
+        return -1;
+    }
+
+    std::unique_ptr<KeyFilter> filter(new KeyFilter());
+    filter->database = database.isEmpty() ? QByteArrayLiteral("main")
+                                          : database;
+    filter->table = table;
+    filter->column = column;
+
+    if (!_rowChangeTracker) {
+        _rowChangeTracker.reset(new RowChangeTracker());
+    }
+    std::vector<std::unique_ptr<KeyFilter> >& filters =
+            _rowChangeTracker->keyFilters;
+    filters.push_back(std::move(filter));
+    installRowChangeHooks();
+
+    // filter stays in list (handle is index), even if it is not built
+    if (!buildKeyFilter(*filters.back(), expectedKeys)) {
+        filters.back().reset();
+        return -1;
+    }
+
+    return static_cast<int>(filters.size()) - 1;
+}
+
+int QsConnection::beginSavepoint() noexcept
+{
+    // check connection
+    if (!_db) {
+        return 0;
+    }
+
+    // transaction may be finished by commit, rollback or sqlite itself
+    if (sqlite3_get_autocommit(_db)) {
+        _savepointLevel = 0;
+    }
+
+    // try begin savepoint of next level
+    const int level = _savepointLevel + 1;
+    if (!runSavepointStatement(level, SavepointBegin)) {
+        return 0;
+    }
+
+    _savepointLevel = level;
+    return level;
+}
+
+QsConnection::BusyStatistics QsConnection::busyStatistics() const noexcept
+{
+    return _busyHandler ? _busyHandler->statistics : BusyStatistics {};
+}
+
+int QsConnection::busyTimeout() const noexcept
+{
+    return _busyHandler ? _busyHandler->timeout : 0;
+}
+
+bool QsConnection::checkpoint(const CheckpointMode mode,
+                              int* const          walFrames,
+                              int* const          checkpointedFrames,
+                              const QByteArray&   schemaName) noexcept
+{
+    static_assert(PassiveCheckpoint == SQLITE_CHECKPOINT_PASSIVE
+                  && TruncateCheckpoint == SQLITE_CHECKPOINT_TRUNCATE,
+                  "CheckpointMode must match sqlite checkpoint modes");
+
+    return _db && sqlite3_wal_checkpoint_v2(
+                _db, schemaName.isEmpty() ? NULL : schemaName.constData(),
+                mode, walFrames, checkpointedFrames) == SQLITE_OK;
+}
+
+void QsConnection::clearStatementCache() noexcept
+{
+    // delete compiled statements
+    for (const CachedStatement& cached : _statementCache) {
+        sqlite3_finalize(cached.stmt);
+    }
+
+    _statementCache.clear();
+}
+
+void QsConnection::flushRowChanges()
+{
+    if (!_rowChangeTracker) {
+        return;
+    }
+
+    // changes, which are counted by sqlite, but not seen by update hook,
+    // are checked, when there is no transaction (statement adds its changes
+    // to count after commit hook)
+    RowChangeTracker& tracker = *_rowChangeTracker;
+    if (tracker.handler && _db && sqlite3_get_autocommit(_db)) {
+        const int total = sqlite3_total_changes(_db);
+        if (static_cast<unsigned>(total - tracker.totalChanges)
+                > static_cast<unsigned>(tracker.hookChanges)) {
+            tracker.committed.append(RowChange {QByteArray(), QByteArray(),
+                                                0, UntrackedChange});
+        }
+
+        tracker.totalChanges = total;
+        tracker.hookChanges = 0;
+    }
+
+    // check if there are committed changes
+    if (tracker.committed.isEmpty()) {
+        return;
+    }
+
+    // take changes first (so handler may run next statements), and keep
+    // capacity of buffer for next commits
+    tracker.delivered.swap(tracker.committed);
+    tracker.committed.clear();
+
+    const RowChanges& changes = tracker.delivered;
+    try {
+        tracker.handler(changes);
+    } catch (...) {
+        tracker.delivered.clear();
+        throw;
+    }
+
+    tracker.delivered.clear();
+}
+
 void QsConnection::close() Q_DECL_NOTHROW
 {
     // check if connection is opened
     if (_db) {
+        // delete cached statements (and statements of key filters)
+        clearStatementCache();
+        clearControlStatements();
+        removeKeyFilters();
+
+        // queries are checked again after reopen (schema may be changed)
+        if (_planChecker) {
+            sqlite3_finalize(_planChecker->schemaVersionStmt);
+            _planChecker->schemaVersionStmt = NULL;
+            _planChecker->schemaVersion = -1;
+            _planChecker->checkedQueries.clear();
+        }
+
         // close connection and reset
         sqlite3_close_v2(_db);
         _db = NULL;
 
-        // clear open error message and collators list
+        // clear open error message, encoding, collators list and images
         _openErrorMsg.clear();
+        _encodingKnown = false;
         _collators = CollatorContainer();
+        _images = ImageContainer();
+
+        // changes of open transaction are rolled back by close
+        if (_rowChangeTracker) {
+            _rowChangeTracker->pending.clear();
+        }
     }
 }
 
 bool QsConnection::commit() Q_DECL_NOTHROW
 {
-    return execute(QByteArrayLiteral("commit"));
+    // commit transaction (savepoints are finished with it)
+    if (runControlStatement(CommitTransaction)) {
+        _savepointLevel = 0;
+        return true;
+    }
+
+    return false;
 }
 
 bool QsConnection::createUtf16Collation(const QByteArray& collationName,
@@ -144,6 +627,37 @@ bool QsConnection::createUtf16Collation(const QByteArray& collationName,
     return false;
 }
 
+bool QsConnection::createVirtualTable(
+        const QByteArray&                   moduleName,
+        std::shared_ptr<QsVirtualTableBase> table,
+        const bool                          eponymousOnly)
+{
+    using TablePtr = std::shared_ptr<QsVirtualTableBase>;
+
+    // check if connection is opened and table exists
+    if (!_db || !table) {
+        return false;
+    }
+
+    // try register module (module data is deleted by sqlite with xDestroy,
+    // also if registration fails)
+    return sqlite3_create_module_v2(
+                _db, moduleName.constData(),
+                QsVirtualTableBase::module(eponymousOnly),
+                new TablePtr(std::move(table)),
+                [] (void* data) { delete static_cast<TablePtr*>(data); })
+            == SQLITE_OK;
+}
+
+bool QsConnection::deleteFunction(const QByteArray& name,
+                                  const int         argumentCount)
+{
+    // check if connection is opened and try delete function
+    return _db && sqlite3_create_function_v2(
+                _db, name.constData(), argumentCount, SQLITE_UTF8,
+                NULL, NULL, NULL, NULL, NULL) == SQLITE_OK;
+}
+
 bool QsConnection::deleteUtf16Collation(const QByteArray& collationName)
 {
     // check if connection is opened and try delete collation for it
@@ -159,6 +673,52 @@ bool QsConnection::deleteUtf16Collation(const QByteArray& collationName)
     return false;
 }
 
+bool QsConnection::deserialize(const QByteArray& image,
+                               const QByteArray& schemaName,
+                               const bool        readOnly)
+{
+    // check if connection is opened
+    if (!_db) {
+        return false;
+    }
+
+    const char* const schema = schemaNameOf(schemaName);
+    const sqlite3_int64 size = image.size();
+    int resultCode;
+
+    if (readOnly) {
+        // share image data with sqlite without copying (QByteArray
+        // reference keeps data alive while database use it)
+        unsigned char* data = reinterpret_cast<unsigned char*>(
+                    const_cast<char*>(image.constData()));
+        resultCode = sqlite3_deserialize(_db, schema, data, size, size,
+                                         SQLITE_DESERIALIZE_READONLY);
+        if (resultCode == SQLITE_OK) {
+            _images.insert(schemaName, image);
+        }
+    } else {
+        // copy image into sqlite owned buffer (sqlite will free it
+        // on close, resize it on write, and free it if deserialize fail)
+        // (at least one byte is allocated to support empty images)
+        unsigned char* data = static_cast<unsigned char*>(
+                    sqlite3_malloc64(size ? static_cast<sqlite3_uint64>(size)
+                                          : 1));
+        if (!data) {
+            return false;
+        }
+
+        memcpy(data, image.constData(), static_cast<size_t>(size));
+        resultCode = sqlite3_deserialize(_db, schema, data, size, size,
+                                         SQLITE_DESERIALIZE_FREEONCLOSE
+                                         | SQLITE_DESERIALIZE_RESIZEABLE);
+        if (resultCode == SQLITE_OK) {
+            _images.remove(schemaName);
+        }
+    }
+
+    return resultCode == SQLITE_OK;
+}
+
 bool QsConnection::execute(const QByteArray& query) const noexcept
 {
     // execute query if connection is opened
@@ -168,7 +728,77 @@ bool QsConnection::execute(const QByteArray& query) const noexcept
 
 bool QsConnection::execute(const QString& query) const
 {
-    return execute(query.toUtf8());
+    // check connection
+    if (!_db) {
+        return false;
+    }
+
+    // compile and run statements one by one (as sqlite3_exec does),
+    // so query text is not converted to UTF-8
+    const void* sql = query.utf16();
+    const void* tail = NULL;
+    const void* end = query.utf16() + query.length();
+    while (sql < end) {
+        sqlite3_stmt* stmt = NULL;
+        int resultCode = qs::blockingPrepare16(
+                    _db, sql,
+                    static_cast<int>(static_cast<const char*>(end)
+                                     - static_cast<const char*>(sql)),
+                    &stmt, &tail);
+        if (resultCode != SQLITE_OK) {
+            return false;
+        }
+
+        // statement is NULL for comment or whitespace
+        if (stmt) {
+            do {
+                resultCode = qs::blockingStep(stmt);
+            } while (resultCode == SQLITE_ROW);
+
+            sqlite3_finalize(stmt);
+            if (resultCode != SQLITE_DONE) {
+                return false;
+            }
+        }
+
+        sql = tail;
+    }
+
+    return true;
+}
+
+QsConnection::Encoding QsConnection::encoding() const noexcept
+{
+    // check connection
+    if (!_db) {
+        return Utf8;
+    }
+
+    // read encoding once (it can not be changed after database is created)
+    if (!_encodingKnown) {
+        sqlite3_stmt* stmt = NULL;
+        if (qs::blockingPrepare(_db, "pragma encoding", -1, 0, &stmt)
+                != SQLITE_OK) {
+            return Utf8;
+        }
+
+        if (qs::blockingStep(stmt) == SQLITE_ROW) {
+            const char* name = reinterpret_cast<const char*>
+                    (sqlite3_column_text(stmt, 0));
+            _encoding = (name && std::strncmp(name, "UTF-16", 6) == 0)
+                    ? Utf16 : Utf8;
+            _encodingKnown = true;
+        }
+
+        sqlite3_finalize(stmt);
+    }
+
+    return _encoding;
+}
+
+bool QsConnection::isReadOnly(const QByteArray& schemaName) const noexcept
+{
+    return _db && sqlite3_db_readonly(_db, schemaNameOf(schemaName)) == 1;
 }
 
 int QsConnection::lastErrorCode() const noexcept
@@ -176,6 +806,12 @@ int QsConnection::lastErrorCode() const noexcept
     return (_db) ? sqlite3_errcode(_db) : ReadResult::ConnectionIsClosed;
 }
 
+int QsConnection::lastExtendedErrorCode() const noexcept
+{
+    return (_db) ? sqlite3_extended_errcode(_db)
+                 : ReadResult::ConnectionIsClosed;
+}
+
 QByteArray QsConnection::lastError() const
 {
     QByteArray result;
@@ -204,6 +840,29 @@ QString QsConnection::lastError16() const
     return result;
 }
 
+QsConnection::KeyFilterStatistics
+QsConnection::keyFilterStatistics(const int filterHandle) const noexcept
+{
+    KeyFilterStatistics statistics {0, 0.0, 0.0, 0, 0};
+    if (!_rowChangeTracker || filterHandle < 0
+            || filterHandle >= static_cast<int>(
+                _rowChangeTracker->keyFilters.size())) {
+        return statistics;
+    }
+
+    const KeyFilter* filter =
+            _rowChangeTracker->keyFilters[filterHandle].get();
+    if (filter) {
+        statistics.keyCount = filter->bloom.keyCount();
+        statistics.saturation = filter->bloom.saturation();
+        statistics.falsePositiveRate = filter->bloom.falsePositiveRate();
+        statistics.skippedCount = filter->skippedCount;
+        statistics.passedCount = filter->passedCount;
+    }
+
+    return statistics;
+}
+
 qint64 QsConnection::lastInsertRowId() const noexcept
 {
     return (_db) ? sqlite3_last_insert_rowid(_db) : 0;
@@ -233,6 +892,13 @@ bool QsConnection::open(OpenMode   openMode,
         } else {
             _openErrorMsg.clear();
         }
+
+        // install busy handler, if it is set
+        if (_busyHandler && _busyHandler->timeout > 0) {
+            sqlite3_busy_handler(_db, BusyHandler::call, _busyHandler.get());
+        }
+
+        installRowChangeHooks();
     }
 
     // return true (connection is opened, or connection was opened before)
@@ -255,7 +921,16 @@ DoubleResult QsConnection::readDouble(const QByteArray& query)
 
 std::pair<double, int> QsConnection::readDouble(const QString& query)
 {
-    return readDouble(query.toUtf8());
+    DoubleResult result;
+
+    // try read double and save read result code
+    result.second = readValue(query,
+                              [&result] (sqlite3_stmt* stmt) -> void {
+        result.first = sqlite3_column_double(stmt, 0);
+    });
+
+    // return result
+    return result;
 }
 
 Int64Result QsConnection::readInt64(const QByteArray& query)
@@ -274,7 +949,16 @@ Int64Result QsConnection::readInt64(const QByteArray& query)
 
 std::pair<qint64, int> QsConnection::readInt64(const QString& query)
 {
-    return readInt64(query.toUtf8());
+    Int64Result result;
+
+    // try read int64 and save read result code
+    result.second = readValue(query,
+                              [&result] (sqlite3_stmt* stmt) -> void {
+        result.first = sqlite3_column_int64(stmt, 0);
+    });
+
+    // return result
+    return result;
 }
 
 StringResult QsConnection::readString(const QByteArray& query)
@@ -294,19 +978,29 @@ StringResult QsConnection::readString(const QByteArray& query)
 
 std::pair<QByteArray, int> QsConnection::readString(const QString& query)
 {
-    return readString(query.toUtf8());
-}
-
-String16Result QsConnection::readString16(const QByteArray& query)
-{
-    String16Result result;
+    StringResult result;
 
     // try read string and save read result code
     result.second = readValue(query, [&result] (sqlite3_stmt* stmt) -> void {
-        result.first = QString(reinterpret_cast<const QChar*>
-                               (sqlite3_column_text16(stmt, 0)),
-                               sqlite3_column_bytes16(stmt,0) / 2);
-    });
+        result.first = QByteArray(reinterpret_cast<const char*>
+                                  (sqlite3_column_text(stmt, 0)),
+                                  sqlite3_column_bytes(stmt, 0));
+    });
+
+    // return result
+    return result;
+}
+
+String16Result QsConnection::readString16(const QByteArray& query)
+{
+    String16Result result;
+
+    // try read string and save read result code
+    result.second = readValue(query, [&result] (sqlite3_stmt* stmt) -> void {
+        result.first = QString(reinterpret_cast<const QChar*>
+                               (sqlite3_column_text16(stmt, 0)),
+                               sqlite3_column_bytes16(stmt,0) / 2);
+    });
 
     // return result
     return result;
@@ -314,12 +1008,225 @@ String16Result QsConnection::readString16(const QByteArray& query)
 
 std::pair<QString, int> QsConnection::readString16(const QString& query)
 {
-    return readString16(query.toUtf8());
+    String16Result result;
+
+    // try read string and save read result code
+    result.second = readValue(query, [&result] (sqlite3_stmt* stmt) -> void {
+        result.first = QString(reinterpret_cast<const QChar*>
+                               (sqlite3_column_text16(stmt, 0)),
+                               sqlite3_column_bytes16(stmt, 0) / 2);
+    });
+
+    // return result
+    return result;
+}
+
+int QsConnection::openSnapshot(const Snapshot&   snapshot,
+                               const QByteArray& schemaName) noexcept
+{
+    if (!_db) {
+        return SQLITE_MISUSE;
+    }
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    return snapshot ? sqlite3_snapshot_open(_db, schemaNameOf(schemaName),
+                                            snapshot.get())
+                    : SQLITE_MISUSE;
+#else
+    Q_UNUSED(snapshot)
+    Q_UNUSED(schemaName)
+    return SQLITE_ERROR;
+#endif
+}
+
+QsConnection::PlanCheckStatistics
+QsConnection::planCheckStatistics() const noexcept
+{
+    return _planChecker ? _planChecker->statistics : PlanCheckStatistics {};
+}
+
+int QsConnection::planIssues(const QsStatement::QueryPlan& plan) noexcept
+{
+    int issues = NoPlanIssue;
+    for (const QsStatement::PlanNode& node : plan) {
+        const QByteArray& detail = node.detail;
+
+        // table scan is "SCAN t" ("SCAN TABLE t" before sqlite 3.36),
+        // which visits all rows (also in order of index, if it is used),
+        // unlike "SEARCH"; scans of subqueries, constant rows and virtual
+        // tables are not issues
+        if (detail.startsWith("SCAN ")
+                && !detail.contains("VIRTUAL TABLE")
+                && !detail.contains("CONSTANT ROW")
+                && !detail.contains("SUBQUERY")
+                && !detail.contains("(subquery")) {
+            issues |= FullTableScan;
+        }
+
+        if (detail.contains("USE TEMP B-TREE")) {
+            issues |= TempBTree;
+        }
+    }
+
+    return issues;
+}
+
+bool QsConnection::prepareCached(const QByteArray& query) noexcept
+{
+    sqlite3_stmt* stmt = NULL;
+    return cachedStatement(query, &stmt) == SQLITE_OK;
+}
+
+bool QsConnection::rebuildKeyFilter(const int    filterHandle,
+                                    const qint64 expectedKeys)
+{
+    if (!_db || !_rowChangeTracker || filterHandle < 0
+            || filterHandle >= static_cast<int>(
+                _rowChangeTracker->keyFilters.size())) {
+        return false;
+    }
+
+    KeyFilter* filter = _rowChangeTracker->keyFilters[filterHandle].get();
+    return filter && buildKeyFilter(*filter, expectedKeys);
+}
+
+bool QsConnection::releaseSavepoint(const int level) noexcept
+{
+    // try release savepoint (with nested ones)
+    if (!isSavepointActive(level)
+            || !runSavepointStatement(level, SavepointRelease)) {
+        return false;
+    }
+
+    _savepointLevel = level - 1;
+    return true;
+}
+
+void QsConnection::removeKeyFilters() noexcept
+{
+    if (!_rowChangeTracker) {
+        return;
+    }
+
+    _rowChangeTracker->keyFilters.clear();
+
+    // tracker is not needed without row change handler
+    if (!_rowChangeTracker->handler) {
+        _rowChangeTracker.reset();
+        installRowChangeHooks();
+    }
+}
+
+void QsConnection::resetBusyStatistics() noexcept
+{
+    if (_busyHandler) {
+        _busyHandler->statistics = BusyStatistics {};
+    }
 }
 
 bool QsConnection::rollback() Q_DECL_NOTHROW
 {
-    return execute(QByteArrayLiteral("rollback"));
+    // rollback transaction (savepoints are finished with it)
+    if (runControlStatement(RollbackTransaction)) {
+        _savepointLevel = 0;
+        return true;
+    }
+
+    return false;
+}
+
+bool QsConnection::rollbackSavepoint(const int level) noexcept
+{
+    // try rollback to savepoint (it stays in transaction) and release it
+    if (!isSavepointActive(level)
+            || !runSavepointStatement(level, SavepointRollback)
+            || !runSavepointStatement(level, SavepointRelease)) {
+        return false;
+    }
+
+    _savepointLevel = level - 1;
+    return true;
+}
+
+QByteArray QsConnection::serialize(const QByteArray& schemaName) const
+{
+    QByteArray result;
+
+    // check if connection is opened
+    if (_db) {
+        const char* const schema = schemaNameOf(schemaName);
+        sqlite3_int64 size = 0;
+
+        // try get pointer to contiguous database image (it is available for
+        // in-memory databases, created by deserialize), and copy it once
+        const unsigned char* data = sqlite3_serialize(
+                    _db, schema, &size, SQLITE_SERIALIZE_NOCOPY);
+        if (data) {
+            if (size <= std::numeric_limits<int>::max()) {
+                result = QByteArray(reinterpret_cast<const char*>(data),
+                                    static_cast<int>(size));
+            }
+        } else {
+            // let sqlite build the image, copy and release it
+            unsigned char* image = sqlite3_serialize(_db, schema, &size, 0);
+            if (image && size <= std::numeric_limits<int>::max()) {
+                result = QByteArray(reinterpret_cast<const char*>(image),
+                                    static_cast<int>(size));
+            }
+            sqlite3_free(image);
+        }
+    }
+
+    return result;
+}
+
+QByteArray
+QsConnection::serializeNoCopy(const QByteArray& schemaName) const noexcept
+{
+    QByteArray result;
+
+    // check if connection is opened and try get pointer to contiguous
+    // database image (data is valid until next change of database)
+    if (_db) {
+        sqlite3_int64 size = 0;
+        const unsigned char* data = sqlite3_serialize(
+                    _db, schemaNameOf(schemaName), &size,
+                    SQLITE_SERIALIZE_NOCOPY);
+        if (data && size <= std::numeric_limits<int>::max()) {
+            result = QByteArray::fromRawData(
+                        reinterpret_cast<const char*>(data),
+                        static_cast<int>(size));
+        }
+    }
+
+    return result;
+}
+
+void QsConnection::setBusyTimeout(const int timeout, const int maxDelay)
+{
+    // create handler state on first use (statistics are kept)
+    if (!_busyHandler) {
+        if (timeout <= 0) {
+            return;
+        }
+
+        _busyHandler.reset(new BusyHandler {0, 0, 0, BusyStatistics {},
+                                            std::minstd_rand()});
+        _busyHandler->random.seed(static_cast<std::minstd_rand::result_type>(
+                std::chrono::steady_clock::now().time_since_epoch().count()));
+    }
+
+    _busyHandler->timeout = std::max(timeout, 0);
+    _busyHandler->maxDelay = std::max(maxDelay, 1);
+
+    // install (or remove) busy handler, if connection is opened
+    if (_db) {
+        if (_busyHandler->timeout > 0) {
+            sqlite3_busy_handler(_db, BusyHandler::call, _busyHandler.get());
+        } else {
+            sqlite3_busy_handler(_db, NULL, NULL);
+        }
+    }
 }
 
 void QsConnection::setDatabaseName(const QByteArray& dbName) Q_DECL_NOTHROW
@@ -330,9 +1237,126 @@ void QsConnection::setDatabaseName(const QByteArray& dbName) Q_DECL_NOTHROW
     }
 }
 
-bool QsConnection::transaction() Q_DECL_NOTHROW
+bool QsConnection::setEncoding(const Encoding encoding) noexcept
+{
+    // check connection
+    if (!_db) {
+        return false;
+    }
+
+    // sqlite ignores pragma, if database content is already created
+    // (UTF-16 without byte order is native byte order of QChar data)
+    _encodingKnown = false;
+    const char* query = (encoding == Utf16) ? "pragma encoding = 'UTF-16'"
+                                            : "pragma encoding = 'UTF-8'";
+    return execute(QByteArray::fromRawData(query, int(std::strlen(query))))
+            && this->encoding() == encoding;
+}
+
+void QsConnection::setPlanCheck(const bool       enabled,
+                                PlanCheckHandler handler)
+{
+    // create check state on first enable (statistics are kept)
+    if (!_planChecker) {
+        if (!enabled) {
+            return;
+        }
+
+        _planChecker.reset(new PlanChecker {false, PlanCheckHandler(),
+                                            PlanCheckStatistics {},
+                                            QSet<QByteArray>()});
+    }
+
+    _planChecker->enabled = enabled;
+    _planChecker->handler = enabled ? std::move(handler)
+                                    : PlanCheckHandler();
+    if (!enabled) {
+        _planChecker->checkedQueries.clear();
+    }
+}
+
+void QsConnection::setRowChangeHandler(RowChangeHandler handler)
+{
+    if (handler) {
+        if (!_rowChangeTracker) {
+            _rowChangeTracker.reset(new RowChangeTracker());
+        }
+        _rowChangeTracker->handler = std::move(handler);
+    } else if (_rowChangeTracker
+               && !_rowChangeTracker->keyFilters.empty()) {
+        // tracker is kept for key filters
+        _rowChangeTracker->handler = RowChangeHandler();
+        _rowChangeTracker->pending.clear();
+        _rowChangeTracker->committed.clear();
+    } else {
+        _rowChangeTracker.reset();
+    }
+
+    installRowChangeHooks();
+}
+
+bool QsConnection::setWalHook(int (*hook)(void*, sqlite3*, const char*, int),
+                              void* const data) noexcept
+{
+    // check connection and set hook
+    if (!_db) {
+        return false;
+    }
+
+    sqlite3_wal_hook(_db, hook, data);
+    return true;
+}
+
+void QsConnection::setStatementCacheSize(const int size) noexcept
+{
+    // cache keeps at least one statement (last used one)
+    _statementCacheSize = (size > 1) ? size : 1;
+
+    // delete least recently used statements, which exceed new size
+    while (_statementCache.size() > _statementCacheSize) {
+        evictCachedStatement();
+    }
+}
+
+int QsConnection::totalChanges() const noexcept
+{
+    return (_db) ? sqlite3_total_changes(_db) : 0;
+}
+
+QsConnection::Snapshot
+QsConnection::takeSnapshot(const QByteArray& schemaName) const noexcept
+{
+    Snapshot result;
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    // sqlite fails, if there is no read transaction or database
+    // is not in WAL mode
+    sqlite3_snapshot* snapshot = nullptr;
+    if (_db && sqlite3_snapshot_get(_db, schemaNameOf(schemaName),
+                                    &snapshot) == SQLITE_OK) {
+        try {
+            result.reset(snapshot, &sqlite3_snapshot_free);
+        } catch (...) {
+            // snapshot is freed by shared pointer on fail
+        }
+    }
+#else
+    Q_UNUSED(schemaName)
+#endif
+
+    return result;
+}
+
+bool QsConnection::transaction(const TransactionType type) Q_DECL_NOTHROW
 {
-    return execute(QByteArrayLiteral("begin"));
+    switch (type) {
+    case TransactionType::Immediate:
+        return runControlStatement(BeginImmediate);
+    case TransactionType::Exclusive:
+        return runControlStatement(BeginExclusive);
+    default:
+        return runControlStatement(BeginDeferred);
+    }
 }
 
 QsConnection& QsConnection::operator =(QsConnection&& connection) Q_DECL_NOTHROW
@@ -345,7 +1369,21 @@ QsConnection& QsConnection::operator =(QsConnection&& connection) Q_DECL_NOTHROW
         _db = connection._db;
         _dbName = std::move(connection._dbName);
         _openErrorMsg = std::move(connection._openErrorMsg);
+        _encoding = connection._encoding;
+        _encodingKnown = connection._encodingKnown;
         _collators = std::move(connection._collators);
+        _images = std::move(connection._images);
+        _statementCache = std::move(connection._statementCache);
+        _statementCacheSize = connection._statementCacheSize;
+        _statementUse = connection._statementUse;
+        std::copy(std::begin(connection._controlStatements),
+                  std::end(connection._controlStatements),
+                  std::begin(_controlStatements));
+        _savepointStatements = std::move(connection._savepointStatements);
+        _savepointLevel = connection._savepointLevel;
+        _busyHandler = std::move(connection._busyHandler);
+        _planChecker = std::move(connection._planChecker);
+        _rowChangeTracker = std::move(connection._rowChangeTracker);
 
         // reset moved object
         connection.reset();
@@ -354,6 +1392,321 @@ QsConnection& QsConnection::operator =(QsConnection&& connection) Q_DECL_NOTHROW
     return *this;
 }
 
+int QsConnection::cachedStatement(const QByteArray& query,
+                                  sqlite3_stmt**    stmt) noexcept
+{
+    // check connection
+    if (!_db) {
+        return ConnectionIsClosed;
+    }
+
+    // try find compiled statement in cache (and mark it as used)
+    auto it = _statementCache.find(query);
+    if (it != _statementCache.end()) {
+        it->lastUse = ++_statementUse;
+        *stmt = it->stmt;
+        return SQLITE_OK;
+    }
+
+    // try compile statement (as long-living statement)
+    const int resultCode = qs::blockingPrepare(_db, query.constData(),
+                                               query.length(),
+                                               SQLITE_PREPARE_PERSISTENT,
+                                               stmt);
+
+    // try save statement to cache (if cache is full, delete least
+    // recently used statement)
+    if (resultCode == SQLITE_OK) {
+        try {
+            if (_statementCache.size() >= _statementCacheSize) {
+                evictCachedStatement();
+            }
+
+            _statementCache.insert(query,
+                                   CachedStatement {*stmt, ++_statementUse});
+        } catch (...) {
+            sqlite3_finalize(*stmt);
+            *stmt = NULL;
+            return SQLITE_NOMEM;
+        }
+
+        checkPlan(*stmt);
+    }
+
+    return resultCode;
+}
+
+void QsConnection::evictCachedStatement() noexcept
+{
+    // cache is small and statement is deleted only before compile of other
+    // one, so linear search is cheaper than list of uses
+    auto oldest = _statementCache.begin();
+    for (auto it = _statementCache.begin(); it != _statementCache.end();
+         ++it) {
+        if (it->lastUse < oldest->lastUse) {
+            oldest = it;
+        }
+    }
+
+    if (oldest != _statementCache.end()) {
+        sqlite3_finalize(oldest->stmt);
+        _statementCache.erase(oldest);
+    }
+}
+
+void QsConnection::checkPlan(sqlite3_stmt* const stmt) const noexcept
+{
+    // check if plan check is enabled
+    if (!_planChecker || !_planChecker->enabled || !stmt) {
+        return;
+    }
+
+    // failed check (or exception of handler) must not fail prepare
+    try {
+        // check each query once per schema version (schema is changed
+        // by this or other connection, so version is read on each check)
+        sqlite3_stmt*& versionStmt = _planChecker->schemaVersionStmt;
+        if (!versionStmt && qs::blockingPrepare(
+                    _db, "pragma schema_version", -1,
+                    SQLITE_PREPARE_PERSISTENT, &versionStmt) != SQLITE_OK) {
+            return;
+        }
+
+        const int version = (qs::blockingStep(versionStmt) == SQLITE_ROW)
+                ? sqlite3_column_int(versionStmt, 0) : -1;
+        sqlite3_reset(versionStmt);
+        if (version != _planChecker->schemaVersion) {
+            _planChecker->checkedQueries.clear();
+            _planChecker->schemaVersion = version;
+        }
+
+        const QByteArray query(sqlite3_sql(stmt));
+        if (_planChecker->checkedQueries.contains(query)) {
+            return;
+        }
+        _planChecker->checkedQueries.insert(query);
+
+        const QsStatement::QueryPlan plan =
+                qs::readQueryPlan(_db, query.constData());
+        const int issues = planIssues(plan);
+
+        PlanCheckStatistics& statistics = _planChecker->statistics;
+        ++statistics.checkedCount;
+        if (issues & FullTableScan) {
+            ++statistics.fullScanCount;
+        }
+        if (issues & TempBTree) {
+            ++statistics.tempBTreeCount;
+        }
+
+        if (issues != NoPlanIssue && _planChecker->handler) {
+            _planChecker->handler(query, issues, plan);
+        }
+    } catch (...) {
+        return;
+    }
+}
+
+void QsConnection::clearControlStatements() noexcept
+{
+    for (sqlite3_stmt*& stmt : _controlStatements) {
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+    }
+
+    for (sqlite3_stmt* stmt : _savepointStatements) {
+        sqlite3_finalize(stmt);
+    }
+
+    _savepointStatements = QVector<sqlite3_stmt*>();
+    _savepointLevel = 0;
+}
+
+void QsConnection::installRowChangeHooks() noexcept
+{
+    if (!_db) {
+        return;
+    }
+
+    // changes are counted from installation of hooks
+    void* const tracker = _rowChangeTracker.get();
+    if (tracker) {
+        _rowChangeTracker->totalChanges = sqlite3_total_changes(_db);
+        _rowChangeTracker->hookChanges = 0;
+    }
+
+    sqlite3_update_hook(_db, tracker ? RowChangeTracker::onUpdate : NULL,
+                        tracker);
+    sqlite3_commit_hook(_db, tracker ? RowChangeTracker::onCommit : NULL,
+                        tracker);
+    sqlite3_rollback_hook(_db, tracker ? RowChangeTracker::onRollback : NULL,
+                          tracker);
+}
+
+bool QsConnection::buildKeyFilter(KeyFilter& filter, const qint64 expectedKeys)
+{
+    filter.valid = false;
+    filter.changedRowIds.clear();
+
+    // names of database and table are written as in schema, so update
+    // hook, which passes them so, compares them as bytes
+    if (!readCanonicalName(_db, QByteArrayLiteral(
+                               "select name from pragma_database_list "
+                               "where name = ?1 collate nocase"),
+                           filter.database)
+            || !readCanonicalName(_db, "select name from \""
+                                  + filter.database + "\".sqlite_master "
+                                  "where type = 'table' "
+                                  "and name = ?1 collate nocase",
+                                  filter.table)) {
+        return false;
+    }
+
+    // filter hashes bytes of keys, so it may reject key, which is equal
+    // to column value only by other collation (e.g. NOCASE)
+    const char* collation = NULL;
+    if (sqlite3_table_column_metadata(_db, filter.database.constData(),
+                                      filter.table.constData(),
+                                      filter.column.constData(), NULL,
+                                      &collation, NULL, NULL, NULL)
+            != SQLITE_OK
+            || (collation && sqlite3_stricmp(collation, "BINARY") != 0)) {
+        return false;
+    }
+
+    // compile statement, which reads key of changed row (it fails
+    // for table without rowid, whose changes are not seen by update hook)
+    const QByteArray source = "\"" + filter.database + "\".\""
+            + filter.table + "\"";
+    const QByteArray keyQuery = "select \"" + filter.column + "\" from "
+            + source + " where rowid = ?";
+    if (!filter.keyStatement
+            && qs::blockingPrepare(_db, keyQuery.constData(),
+                                   keyQuery.length(), SQLITE_PREPARE_PERSISTENT,
+                                   &filter.keyStatement) != SQLITE_OK) {
+        return false;
+    }
+
+    // size filter for current rows (at least)
+    const std::pair<qint64, int> rowCount =
+            readInt64("select count(*) from " + source);
+    if (rowCount.second != ReadSuccess) {
+        return false;
+    }
+    filter.bloom.reset(std::max(expectedKeys, rowCount.first));
+
+    // scan keys (NULL is not equal to any key)
+    const QByteArray scanQuery = "select \"" + filter.column + "\" from "
+            + source;
+    sqlite3_stmt* stmt = NULL;
+    if (qs::blockingPrepare(_db, scanQuery.constData(), scanQuery.length(),
+                            0, &stmt) != SQLITE_OK) {
+        return false;
+    }
+
+    int code;
+    while ((code = qs::blockingStep(stmt)) == SQLITE_ROW) {
+        addColumnKey(filter.bloom, stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    filter.valid = code == SQLITE_DONE;
+    return filter.valid;
+}
+
+void QsConnection::syncKeyFilter(KeyFilter& filter) noexcept
+{
+    sqlite3_stmt* stmt = filter.keyStatement;
+    for (const qint64 rowId : filter.changedRowIds) {
+        // row of rolled back change is not found
+        sqlite3_bind_int64(stmt, 1, rowId);
+        const int code = qs::blockingStep(stmt);
+        if (code == SQLITE_ROW) {
+            addColumnKey(filter.bloom, stmt);
+        }
+        sqlite3_reset(stmt);
+
+        if (code != SQLITE_ROW && code != SQLITE_DONE) {
+            filter.valid = false;
+            break;
+        }
+    }
+
+    filter.changedRowIds.clear();
+}
+
+bool QsConnection::mayContainHash(const int     filterHandle,
+                                  const quint64 hash) noexcept
+{
+    if (!_rowChangeTracker || filterHandle < 0
+            || filterHandle >= static_cast<int>(
+                _rowChangeTracker->keyFilters.size())) {
+        return true;
+    }
+
+    KeyFilter* filter = _rowChangeTracker->keyFilters[filterHandle].get();
+    if (!filter || !filter->valid) {
+        return true;
+    }
+
+    // add keys of rows, changed since last check
+    if (!filter->changedRowIds.isEmpty()) {
+        syncKeyFilter(*filter);
+        if (!filter->valid) {
+            return true;
+        }
+    }
+
+    if (filter->bloom.mayContain(hash)) {
+        ++filter->passedCount;
+        return true;
+    }
+
+    ++filter->skippedCount;
+    return false;
+}
+
+quint64 QsConnection::keyHash(const int key) noexcept
+{
+    return qs::BloomFilter::hashInt(key);
+}
+
+quint64 QsConnection::keyHash(const qint64 key) noexcept
+{
+    return qs::BloomFilter::hashInt(key);
+}
+
+quint64 QsConnection::keyHash(const double key) noexcept
+{
+    return qs::BloomFilter::hashDouble(key);
+}
+
+quint64 QsConnection::keyHash(const QByteArray& key) noexcept
+{
+    return qs::BloomFilter::hashBytes(key.constData(), key.size());
+}
+
+quint64 QsConnection::keyHash(const QString& key) noexcept
+{
+    return qs::BloomFilter::hashUtf16(key.constData(), key.size());
+}
+
+quint64 QsConnection::keyHash(const char* const key) noexcept
+{
+    return qs::BloomFilter::hashBytes(
+                key, key ? static_cast<int>(std::strlen(key)) : 0);
+}
+
+bool QsConnection::isSavepointActive(const int level) noexcept
+{
+    // check if transaction is not finished (by sqlite itself)
+    if (!_db || sqlite3_get_autocommit(_db)) {
+        _savepointLevel = 0;
+    }
+
+    return level > 0 && level <= _savepointLevel;
+}
+
 int QsConnection::openInMemoryDb(CacheMode cacheMode)
 {
     // build URI string
@@ -371,65 +1724,147 @@ int QsConnection::openInMemoryDb(CacheMode cacheMode)
     return sqlite3_open_v2(uriStr.constData(), &_db, SQLITE_OPEN_URI, NULL);
 }
 
+bool QsConnection::registerFunction(
+        const QByteArray& name,
+        const int         argumentCount,
+        const int         flags,
+        void*             function,
+        void (*xFunc)(sqlite3_context*, int, sqlite3_value**),
+        void (*xStep)(sqlite3_context*, int, sqlite3_value**),
+        void (*xFinal)(sqlite3_context*),
+        void (*xDestroy)(void*))
+{
+    // try register function (sqlite calls xDestroy for function object
+    // when function is deleted, replaced, or if registration fails)
+    return sqlite3_create_function_v2(_db, name.constData(), argumentCount,
+                                      getFunctionFlags(flags), function,
+                                      xFunc, xStep, xFinal, xDestroy)
+            == SQLITE_OK;
+}
+
+bool QsConnection::registerWindowFunction(
+        const QByteArray& name,
+        const int         argumentCount,
+        const int         flags,
+        void*             function,
+        void (*xStep)(sqlite3_context*, int, sqlite3_value**),
+        void (*xFinal)(sqlite3_context*),
+        void (*xValue)(sqlite3_context*),
+        void (*xInverse)(sqlite3_context*, int, sqlite3_value**),
+        void (*xDestroy)(void*))
+{
+    // try register window function (function object is managed by sqlite)
+    return sqlite3_create_window_function(_db, name.constData(), argumentCount,
+                                          getFunctionFlags(flags), function,
+                                          xStep, xFinal, xValue, xInverse,
+                                          xDestroy) == SQLITE_OK;
+}
+
 int QsConnection::openRegularDb(const int flags) noexcept
 {
     return sqlite3_open_v2(_dbName.constData(), &_db, flags, NULL);
 }
 
+int QsConnection::prepareRead(const QByteArray& query,
+                              sqlite3_stmt**    stmt) noexcept
+{
+    // try get compiled statement and check if statement return any data
+    int resultCode = cachedStatement(query, stmt);
+    if (resultCode == SQLITE_OK && !sqlite3_column_count(*stmt)) {
+        resultCode = NoData;
+    }
+
+    return resultCode;
+}
+
+int QsConnection::stepRead(sqlite3_stmt* stmt) noexcept
+{
+    // try get row and check value type is not NULL
+    // (return sqlite error code, if step fails)
+    switch (const int resultCode = qs::blockingStep(stmt)) {
+    case SQLITE_ROW:
+        return (sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+                ? ReadSuccess : NullValue;
+    case SQLITE_DONE:
+        return EmptyData;
+    default:
+        return resultCode;
+    }
+}
+
 int
 QsConnection::readValue(const QByteArray&                          query,
                         const std::function<void (sqlite3_stmt*)>& readLambda)
 {
     // check connection
-    if (_db) {
-        // try prepare statement
-        sqlite3_stmt *stmt;
-        int resultCode = sqlite3_prepare_v2(_db, query.constData(),
-                                            query.length(), &stmt, NULL);
+    if (!_db) {
+        return ConnectionIsClosed;
+    }
 
-        // if success, try read data (or set the error code)
-        if (resultCode == SQLITE_OK) {
+    // try prepare statement and read value (or return sqlite error code)
+    sqlite3_stmt *stmt;
+    const int resultCode = qs::blockingPrepare(_db, query.constData(),
+                                               query.length(), 0, &stmt);
+    return (resultCode == SQLITE_OK) ? readFirstValue(stmt, readLambda)
+                                     : resultCode;
+}
+
+int
+QsConnection::readValue(const QString&                             query,
+                        const std::function<void (sqlite3_stmt*)>& readLambda)
+{
+    // check connection
+    if (!_db) {
+        return ConnectionIsClosed;
+    }
+
+    // compile query from UTF-16 text (without conversion to UTF-8)
+    sqlite3_stmt *stmt;
+    const int resultCode = qs::blockingPrepare16(_db, query.utf16(),
+                                                 query.length() * 2, &stmt);
+    return (resultCode == SQLITE_OK) ? readFirstValue(stmt, readLambda)
+                                     : resultCode;
+}
 
-            // check if statement return any data
-            if (sqlite3_column_count(stmt)) {
-
-                // check if statement has prepared row
-                if (sqlite3_step(stmt) == SQLITE_ROW) {
-
-                    // check value type is not NULL
-                    if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
-
-                        // catch potential exception of std::function object
-                        try {
-                            // read value
-                            readLambda(stmt);
-                            resultCode = ReadSuccess;
-                        } catch (...) {
-                            // delete prepared statement and re-throw
-                            sqlite3_finalize(stmt);
-                            throw;
-                        }
-
-                    } else {
-                        resultCode = NullValue;
-                    }
-                } else {
-                    resultCode = EmptyData;
+int QsConnection::readFirstValue(
+        sqlite3_stmt*                              stmt,
+        const std::function<void (sqlite3_stmt*)>& readLambda)
+{
+    int resultCode;
+
+    // check if statement return any data
+    if (sqlite3_column_count(stmt)) {
+
+        // check if statement has prepared row
+        if (qs::blockingStep(stmt) == SQLITE_ROW) {
+
+            // check value type is not NULL
+            if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+
+                // catch potential exception of std::function object
+                try {
+                    // read value
+                    readLambda(stmt);
+                    resultCode = ReadSuccess;
+                } catch (...) {
+                    // delete prepared statement and re-throw
+                    sqlite3_finalize(stmt);
+                    throw;
                 }
+
             } else {
-                resultCode = NoData;
+                resultCode = NullValue;
             }
-
-            // delete prepared statement and return result code
-            sqlite3_finalize(stmt);
+        } else {
+            resultCode = EmptyData;
         }
-
-        // return code of sqlite error
-        return resultCode;
     } else {
-        // return ConnectionIsClosed error code
-        return ConnectionIsClosed;
+        resultCode = NoData;
     }
+
+    // delete prepared statement and return result code
+    sqlite3_finalize(stmt);
+    return resultCode;
 }
 
 void QsConnection::reset() Q_DECL_NOTHROW
@@ -438,6 +1873,63 @@ void QsConnection::reset() Q_DECL_NOTHROW
     _db = NULL;
     _dbName = QByteArray();
     _openErrorMsg = QByteArray();
+    _encodingKnown = false;
     _collators = CollatorContainer();
+    _images = ImageContainer();
+    _statementCache.clear();
+    std::fill(std::begin(_controlStatements),
+              std::end(_controlStatements), nullptr);
+    _savepointStatements = QVector<sqlite3_stmt*>();
+    _savepointLevel = 0;
+}
+
+bool QsConnection::runControlStatement(
+        const ControlStatement statement) noexcept
+{
+    return runStatement(_controlStatements[statement],
+                        controlQueries[statement]);
+}
+
+bool QsConnection::runSavepointStatement(
+        const int                level,
+        const SavepointStatement statement) noexcept
+{
+    // find statement in array (extend array for new level, if needed)
+    const int index = (level - 1) * SavepointStatementCount + statement;
+    try {
+        if (index >= _savepointStatements.size()) {
+            _savepointStatements.resize(level * SavepointStatementCount);
+        }
+    } catch (...) {
+        return false;
+    }
+
+    // build query and run statement
+    char query[48];
+    std::snprintf(query, sizeof(query), savepointFormats[statement], level);
+
+    return runStatement(_savepointStatements[index], query);
+}
+
+bool QsConnection::runStatement(sqlite3_stmt*&    stmt,
+                                const char* const query) noexcept
+{
+    // check connection
+    if (!_db) {
+        return false;
+    }
+
+    // compile statement on first use
+    if (!stmt && qs::blockingPrepare(_db, query, -1,
+                                     SQLITE_PREPARE_PERSISTENT,
+                                     &stmt) != SQLITE_OK) {
+        return false;
+    }
+
+    // execute statement and reset it
+    const bool result = qs::blockingStep(stmt) == SQLITE_DONE;
+    sqlite3_reset(stmt);
+
+    return result;
 }
 
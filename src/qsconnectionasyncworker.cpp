@@ -10,47 +10,63 @@ using OperationResult = std::pair<bool, QByteArray>;
 
 namespace {
 
-template<typename T>
-QByteArray createTaskPtr(std::shared_ptr<T>& taskPtr,
-                         T&                  task) Q_DECL_NOTHROW
+const QByteArray stoppedWorkerErr =
+        QByteArrayLiteral("Error: worker thread is stopped.");
+
+// set handlers of job (handler may be run in worker thread)
+void setHandler(qs::Job&                             job,
+                QsConnectionAsyncWorker::OnSuccess&& onSuccess,
+                QsConnectionAsyncWorker::OnError&&   onError,
+                const bool handleInWorkerThread) noexcept
 {
-    QByteArray result;
-
-    try {
-        taskPtr = std::make_shared<T>(std::move(task));
-    } catch (const std::exception& exception) {
-        try {
-            result = exception.what();
-        } catch (...) {
-            result = qs::badAllocErrMsg;
-        }
-    } catch (...) {
-        result = qs::unknownExceptionErrMsg;
-    }
+    job.handler.handler.first = std::move(onSuccess);
+    job.handler.handler.second = std::move(onError);
+    job.delivery = handleInWorkerThread ? qs::Job::HandleInWorkerThread
+                                        : qs::Job::HandleInObjectThread;
+}
 
-    return result;
+void setHandler(qs::Job&                              job,
+                QsConnectionAsyncWorker::HandlerPtr&& handlerPtr,
+                const bool handleInWorkerThread) noexcept
+{
+    job.handler.handlerPtr = std::move(handlerPtr);
+    job.handler.isShared = true;
+    job.delivery = handleInWorkerThread ? qs::Job::HandleInWorkerThread
+                                        : qs::Job::HandleInObjectThread;
 }
 
-QByteArray
-createHandlerPtr(QsConnectionAsyncWorker::HandlerPtr& handlerPtr,
-                 QsConnectionAsyncWorker::OnSuccess&  onSuccess,
-                 QsConnectionAsyncWorker::OnError&    onError) Q_DECL_NOTHROW
+// tasks, given by pointers, are called through pointer
+// (lambda with pointer is stored without allocation)
+
+void setTask(qs::Job& job, QsConnectionAsyncWorker::TaskPtr&& taskPtr)
 {
-    QByteArray result;
+    if (taskPtr) {
+        job.task = [taskPtr = std::move(taskPtr)] (QsConnection& connection) {
+            return (*taskPtr)(connection);
+        };
+    }
+}
 
-    try {
-        handlerPtr = createHandler(std::move(onSuccess), std::move(onError));
-    } catch (const std::exception& exception) {
-        try {
-            result = exception.what();
-        } catch (...) {
-            result = qs::badAllocErrMsg;
-        }
-    } catch (...) {
-        result = qs::unknownExceptionErrMsg;
+void setTask(qs::Job& job, QsConnectionAsyncWorker::StmtTaskPtr&& taskPtr)
+{
+    job.kind = qs::Job::RunStmtTask;
+    if (taskPtr) {
+        job.stmtTask = [taskPtr = std::move(taskPtr)] (
+                QsStatement statement, bool& commitChanges) {
+            return (*taskPtr)(std::move(statement), commitChanges);
+        };
     }
+}
 
-    return result;
+void setTask(qs::Job& job, QsConnectionAsyncWorker::PreparedTaskPtr&& taskPtr)
+{
+    job.kind = qs::Job::RunPreparedTask;
+    if (taskPtr) {
+        job.preparedTask = [taskPtr = std::move(taskPtr)] (
+                const QsStatement& statement, bool& commitChanges) {
+            return (*taskPtr)(statement, commitChanges);
+        };
+    }
 }
 
 }
@@ -115,26 +131,12 @@ QsConnectionAsyncWorker::execute(Task      task,
                                  OnError   onError,
                                  bool      handleInWorkerThread) Q_DECL_NOTHROW
 {
-    OperationResult result;
-    TaskPtr taskPtr;
-    HandlerPtr handlerPtr;
-
-    result.first = false;
-
-    // try move task into taskPtr
-    result.second = createTaskPtr<Task>(taskPtr, task);
-    if (result.second.isEmpty()) {
-        // try move onSuccess and onError into handlerPtr
-        result.second = createHandlerPtr(handlerPtr, onSuccess, onError);
+    qs::Job job;
+    job.task = std::move(task);
+    setHandler(job, std::move(onSuccess), std::move(onError),
+               handleInWorkerThread);
 
-        // if success, try start execution
-        if (result.second.isEmpty()) {
-            result = execute(std::move(taskPtr), std::move(handlerPtr),
-                             handleInWorkerThread);
-        }
-    }
-
-    return result;
+    return submit(job);
 }
 
 OperationResult QsConnectionAsyncWorker::execute(
@@ -142,57 +144,31 @@ OperationResult QsConnectionAsyncWorker::execute(
         HandlerPtr handlerPtr,
         bool       handleInWorkerThread) Q_DECL_NOTHROW
 {
-    // check if worker and worker thread exists
-    OperationResult result(true, checkWorkerThread());
-
-    // if success, send task to worker,
-    // otherwise return error message in result
-    if (result.second.isEmpty()) {
-        emit execWithHandlerSignal(std::move(taskPtr), std::move(handlerPtr),
-                                   handleInWorkerThread, QPrivateSignal());
-    } else {
-        result.first = false;
-    }
+    qs::Job job;
+    setTask(job, std::move(taskPtr));
+    setHandler(job, std::move(handlerPtr), handleInWorkerThread);
 
-    return result;
+    return submit(job);
 }
 
 OperationResult QsConnectionAsyncWorker::execute(Task     task,
                                                  QVariant data) Q_DECL_NOTHROW
 {
-    OperationResult result;
-    TaskPtr taskPtr;
-
-    result.first = false;
+    qs::Job job;
+    job.task = std::move(task);
+    job.data = std::move(data);
 
-    // try move task into taskPtr
-    result.second = createTaskPtr<Task>(taskPtr, task);
-    if (result.second.isEmpty()) {
-        // if success, try start execution
-        if (result.second.isEmpty()) {
-            result = execute(std::move(taskPtr), std::move(data));
-        }
-    }
-
-    return result;
+    return submit(job);
 }
 
 OperationResult QsConnectionAsyncWorker::execute(TaskPtr  taskPtr,
                                                  QVariant data) Q_DECL_NOTHROW
 {
-    // check if worker and worker thread exists
-    OperationResult result(true, checkWorkerThread());
-
-    // if success, send task to worker,
-    // otherwise return error message in result
-    if (result.second.isEmpty()) {
-        emit execWithDataSignal(std::move(taskPtr), std::move(data),
-                                QPrivateSignal());
-    } else {
-        result.first = false;
-    }
+    qs::Job job;
+    setTask(job, std::move(taskPtr));
+    job.data = std::move(data);
 
-    return result;
+    return submit(job);
 }
 
 OperationResult QsConnectionAsyncWorker::execute(
@@ -203,27 +179,15 @@ OperationResult QsConnectionAsyncWorker::execute(
         bool       inTransaction,
         bool       handleInWorkerThread) Q_DECL_NOTHROW
 {
-    OperationResult result;
-    StmtTaskPtr taskPtr;
-    HandlerPtr handlerPtr;
-
-    result.first = false;
-
-    // try move task into taskPtr
-    result.second = createTaskPtr<StmtTask>(taskPtr, task);
-    if (result.second.isEmpty()) {
-        // try move onSuccess and onError into handlerPtr
-        result.second = createHandlerPtr(handlerPtr, onSuccess, onError);
-
-        // if success, try start execution
-        if (result.second.isEmpty()) {
-            result = execute(std::move(taskPtr), std::move(query),
-                             std::move(handlerPtr), inTransaction,
-                             handleInWorkerThread);
-        }
-    }
-
-    return result;
+    qs::Job job;
+    job.kind = qs::Job::RunStmtTask;
+    job.stmtTask = std::move(task);
+    job.query = std::move(query);
+    job.inTransaction = inTransaction;
+    setHandler(job, std::move(onSuccess), std::move(onError),
+               handleInWorkerThread);
+
+    return submit(job);
 }
 
 OperationResult QsConnectionAsyncWorker::execute(
@@ -233,20 +197,13 @@ OperationResult QsConnectionAsyncWorker::execute(
         bool        inTransaction,
         bool        handleInWorkerThread) Q_DECL_NOTHROW
 {
-    // check if worker and worker thread exists
-    OperationResult result(true, checkWorkerThread());
-
-    // if success, send task to worker,
-    // otherwise return error message in result
-    if (result.second.isEmpty()) {
-        emit execStmtWithHandlerSignal(std::move(taskPtr), std::move(query),
-                                       inTransaction, std::move(handlerPtr),
-                                       handleInWorkerThread, QPrivateSignal());
-    } else {
-        result.first = false;
-    }
+    qs::Job job;
+    setTask(job, std::move(taskPtr));
+    job.query = std::move(query);
+    job.inTransaction = inTransaction;
+    setHandler(job, std::move(handlerPtr), handleInWorkerThread);
 
-    return result;
+    return submit(job);
 }
 
 OperationResult
@@ -255,22 +212,14 @@ QsConnectionAsyncWorker::execute(StmtTask   task,
                                  bool       inTransaction,
                                  QVariant   data) Q_DECL_NOTHROW
 {
-    OperationResult result;
-    StmtTaskPtr taskPtr;
-
-    result.first = false;
-
-    // try move task into taskPtr
-    result.second = createTaskPtr<StmtTask>(taskPtr, task);
-    if (result.second.isEmpty()) {
-        // if success, try start execution
-        if (result.second.isEmpty()) {
-            result = execute(std::move(taskPtr), std::move(query),
-                             inTransaction, std::move(data));
-        }
-    }
-
-    return result;
+    qs::Job job;
+    job.kind = qs::Job::RunStmtTask;
+    job.stmtTask = std::move(task);
+    job.query = std::move(query);
+    job.inTransaction = inTransaction;
+    job.data = std::move(data);
+
+    return submit(job);
 }
 
 OperationResult
@@ -279,20 +228,98 @@ QsConnectionAsyncWorker::execute(StmtTaskPtr taskPtr,
                                  bool        inTransaction,
                                  QVariant    data) Q_DECL_NOTHROW
 {
-    // check if worker and worker thread exists
-    OperationResult result(true, checkWorkerThread());
-
-    // if success, send task to worker,
-    // otherwise return error message in result
-    if (result.second.isEmpty()) {
-        emit execStmtWithDataSignal(std::move(taskPtr), std::move(query),
-                                    inTransaction, std::move(data),
-                                    QPrivateSignal());
-    } else {
-        result.first = false;
-    }
+    qs::Job job;
+    setTask(job, std::move(taskPtr));
+    job.query = std::move(query);
+    job.inTransaction = inTransaction;
+    job.data = std::move(data);
 
-    return result;
+    return submit(job);
+}
+
+OperationResult QsConnectionAsyncWorker::execute(
+        PreparedTask task,
+        int          statementHandle,
+        OnSuccess    onSuccess,
+        OnError      onError,
+        bool         inTransaction,
+        bool         handleInWorkerThread) Q_DECL_NOTHROW
+{
+    qs::Job job;
+    job.kind = qs::Job::RunPreparedTask;
+    job.preparedTask = std::move(task);
+    job.statementHandle = statementHandle;
+    job.inTransaction = inTransaction;
+    setHandler(job, std::move(onSuccess), std::move(onError),
+               handleInWorkerThread);
+
+    return submit(job);
+}
+
+OperationResult QsConnectionAsyncWorker::execute(
+        PreparedTaskPtr taskPtr,
+        int             statementHandle,
+        HandlerPtr      handlerPtr,
+        bool            inTransaction,
+        bool            handleInWorkerThread) Q_DECL_NOTHROW
+{
+    qs::Job job;
+    setTask(job, std::move(taskPtr));
+    job.statementHandle = statementHandle;
+    job.inTransaction = inTransaction;
+    setHandler(job, std::move(handlerPtr), handleInWorkerThread);
+
+    return submit(job);
+}
+
+OperationResult
+QsConnectionAsyncWorker::execute(PreparedTask task,
+                                 int          statementHandle,
+                                 bool         inTransaction,
+                                 QVariant     data) Q_DECL_NOTHROW
+{
+    qs::Job job;
+    job.kind = qs::Job::RunPreparedTask;
+    job.preparedTask = std::move(task);
+    job.statementHandle = statementHandle;
+    job.inTransaction = inTransaction;
+    job.data = std::move(data);
+
+    return submit(job);
+}
+
+OperationResult
+QsConnectionAsyncWorker::execute(PreparedTaskPtr taskPtr,
+                                 int             statementHandle,
+                                 bool            inTransaction,
+                                 QVariant        data) Q_DECL_NOTHROW
+{
+    qs::Job job;
+    setTask(job, std::move(taskPtr));
+    job.statementHandle = statementHandle;
+    job.inTransaction = inTransaction;
+    job.data = std::move(data);
+
+    return submit(job);
+}
+
+OperationResult QsConnectionAsyncWorker::executeCached(
+        PreparedTask task,
+        int          statementHandle,
+        QVariantList params,
+        OnSuccess    onSuccess,
+        OnError      onError,
+        bool         handleInWorkerThread) Q_DECL_NOTHROW
+{
+    qs::Job job;
+    job.kind = qs::Job::RunCachedTask;
+    job.preparedTask = std::move(task);
+    job.statementHandle = statementHandle;
+    job.params = std::move(params);
+    setHandler(job, std::move(onSuccess), std::move(onError),
+               handleInWorkerThread);
+
+    return submit(job);
 }
 
 std::pair<bool, QByteArray> QsConnectionAsyncWorker::stop(
@@ -307,22 +334,34 @@ QsConnectionAsyncWorker::stopAndWait() Q_DECL_NOTHROW
     return stop(ULONG_MAX);
 }
 
-void QsConnectionAsyncWorker::onExecuted(
-        QsConnectionWorker::ExecResultPtr resultPtr,
-        HandlerPtr                        handlerPtr) Q_DECL_NOTHROW
+void QsConnectionAsyncWorker::onResultsQueued() Q_DECL_NOTHROW
 {
-    // check if resultPtr is not empty
-    if (resultPtr) {
-        // try process result
-        QByteArray errorMsg = qs::processExexResult(
-                    resultPtr.get(), handlerPtr);
-
-        // check if no exception while process result
-        // (otherwise emit signal with exception error message)
-        if (!errorMsg.isEmpty()) {
-            emit error(std::move(errorMsg));
-        }
+    // get job queue (it is cleared, when worker thread stops)
+    std::shared_ptr<qs::JobQueue> jobQueue;
+    {
+        QMutexLocker locker {&_mutex};
+        jobQueue = _jobQueue;
     }
+
+    if (!jobQueue) {
+        return;
+    }
+
+    // run handlers in order of results
+    jobQueue->results.consume([this] (qs::JobResult& jobResult) {
+        const QsError unhandledError = qs::processExecResult(
+                    &jobResult.result, jobResult.handler.get());
+
+        // emit signal with message of error, which is not handled
+        // (error without error handler or exception of handler)
+        if (!unhandledError.isEmpty()) {
+            try {
+                emit error(unhandledError.message());
+            } catch (...) {
+                emit error(qs::badAllocErrMsg);
+            }
+        }
+    });
 }
 
 void QsConnectionAsyncWorker::onThreadFinished() Q_DECL_NOTHROW
@@ -356,31 +395,18 @@ QByteArray QsConnectionAsyncWorker::checkWorkerThread() Q_DECL_NOTHROW
 
 void QsConnectionAsyncWorker::connectTo(QsConnectionWorker* worker)
 {
-    // connect this signals to worker object slots and save connections to array
-    _workerObjConnections.append(
-                connect(this, &QsConnectionAsyncWorker::execWithDataSignal,
-                        worker, &QsConnectionWorker::execWithData,
-                        Qt::QueuedConnection));
-    _workerObjConnections.append(
-                connect(this, &QsConnectionAsyncWorker::execWithHandlerSignal,
-                        worker, &QsConnectionWorker::execWithHandler,
-                        Qt::QueuedConnection));
-    _workerObjConnections.append(
-                connect(this, &QsConnectionAsyncWorker::execStmtWithDataSignal,
-                        worker, &QsConnectionWorker::execStatementWithData,
-                        Qt::QueuedConnection));
+    // connect this signal to worker object slot and save connection
     _workerObjConnections.append(
-                connect(this,
-                        &QsConnectionAsyncWorker::execStmtWithHandlerSignal,
-                        worker, &QsConnectionWorker::execStatementWithHandler,
+                connect(this, &QsConnectionAsyncWorker::jobsQueued,
+                        worker, &QsConnectionWorker::processJobs,
                         Qt::QueuedConnection));
 
     // connect worker object signals to this slots
     connect(worker, &QsConnectionWorker::finished,
             this, &QsConnectionAsyncWorker::finished,
             Qt::QueuedConnection);
-    connect(worker, &QsConnectionWorker::executed,
-            this, &QsConnectionAsyncWorker::onExecuted,
+    connect(worker, &QsConnectionWorker::resultsQueued,
+            this, &QsConnectionAsyncWorker::onResultsQueued,
             Qt::QueuedConnection);
     connect(worker, &QsConnectionWorker::error,
             this, &QsConnectionAsyncWorker::error,
@@ -388,6 +414,9 @@ void QsConnectionAsyncWorker::connectTo(QsConnectionWorker* worker)
     connect(worker, &QsConnectionWorker::errorWithData,
             this, &QsConnectionAsyncWorker::errorWithData,
             Qt::QueuedConnection);
+    connect(worker, &QsConnectionWorker::rowsChanged,
+            this, &QsConnectionAsyncWorker::rowsChanged,
+            Qt::QueuedConnection);
 }
 
 void QsConnectionAsyncWorker::createWorkerThread()
@@ -409,6 +438,11 @@ void QsConnectionAsyncWorker::createWorkerThread()
         thread = newThread.get();
         QsConnectionWorker* worker = newWorker.get();
 
+        // share new job queue with worker object
+        std::shared_ptr<qs::JobQueue> jobQueue =
+                std::make_shared<qs::JobQueue>();
+        worker->setJobQueue(jobQueue);
+
         // move worker object to new thread
         worker->moveToThread(thread);
 
@@ -426,6 +460,13 @@ void QsConnectionAsyncWorker::createWorkerThread()
         // and save connections into _workerObjConnections
         connectTo(worker);
 
+        // open connection in worker thread before first task, if needed
+        // (slot is called directly in worker thread before event loop)
+        if (_connectionConfig.warmUpOnStart()) {
+            connect(thread, &QsWorkerThread::started,
+                    worker, &QsConnectionWorker::warmUp);
+        }
+
         // start created thread
         thread->start();
 
@@ -433,7 +474,8 @@ void QsConnectionAsyncWorker::createWorkerThread()
         newThread.release();
         newWorker.release();
 
-        // save pointer to thread
+        // save pointers to thread and job queue
+        _jobQueue = std::move(jobQueue);
         _activeThread.storeRelease(thread);
     }
 }
@@ -445,8 +487,15 @@ QsConnectionAsyncWorker::disconnectWorkerObject(
 {
     OperationResult result;
 
-    // clear pointer to worker thread and save previous pointer
-    QsWorkerThread* thread = _activeThread.fetchAndStoreRelease(nullptr);
+    // clear pointer to worker thread and job queue (not executed jobs are
+    // deleted with worker object) under lock of submit, so no job is
+    // submitted to stopped worker
+    QsWorkerThread* thread = nullptr;
+    {
+        QMutexLocker locker {&_mutex};
+        thread = _activeThread.fetchAndStoreRelease(nullptr);
+        _jobQueue.reset();
+    }
 
     result.first = (thread == nullptr);
 
@@ -487,4 +536,56 @@ QsConnectionAsyncWorker::disconnectWorkerObject(
     return result;
 }
 
+OperationResult QsConnectionAsyncWorker::submit(qs::Job& job) Q_DECL_NOTHROW
+{
+    // check if worker and worker thread exists
+    OperationResult result(false, checkWorkerThread());
+    if (!result.second.isEmpty()) {
+        return result;
+    }
+
+    // try move job into queue (worker may be stopped by other thread
+    // after check of worker thread)
+    bool wakeUpWorker = false;
+    try {
+        QMutexLocker locker {&_mutex};
+        if (_jobQueue && _activeThread.loadAcquire()) {
+            wakeUpWorker = _jobQueue->jobs.push(std::move(job));
+            result.first = true;
+        } else {
+            result.second = stoppedWorkerErr;
+        }
+    } catch (...) {
+        return currentExceptionResult();
+    }
+
+    // wake worker up for first job of batch
+    if (wakeUpWorker) {
+        emit jobsQueued(QPrivateSignal());
+    }
+
+    return result;
+}
+
+OperationResult
+QsConnectionAsyncWorker::currentExceptionResult() Q_DECL_NOTHROW
+{
+    OperationResult result(false, QByteArray());
+
+    // re-throw current exception and save it's message
+    try {
+        throw;
+    } catch (const std::exception& exception) {
+        try {
+            result.second = exception.what();
+        } catch (...) {
+            result.second = qs::badAllocErrMsg;
+        }
+    } catch (...) {
+        result.second = qs::unknownExceptionErrMsg;
+    }
+
+    return result;
+}
+
 #include "qsconnectionasyncworker.moc"
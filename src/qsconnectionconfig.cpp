@@ -1,9 +1,29 @@
 #include "../include/qsconnectionconfig.h"
 
-#include <QByteArrayList>
+#include <algorithm>
 
 #include "qshelper.h"
 
+namespace {
+
+// return quoted sqlite identifier
+QByteArray quotedName(QByteArray name)
+{
+    return name.replace('"', "\"\"").prepend('"').append('"');
+}
+
+// error of last sqlite call of connection with context, which is not
+// string literal (so message is formatted at once)
+QsError connectionError(const QByteArray& context,
+                        const QsConnection& connection)
+{
+    return QsError(QsError::SqliteError,
+                   context + QsError::fromConnection("", connection).message(),
+                   connection.lastExtendedErrorCode());
+}
+
+}
+
 
 bool operator ==(const QsConnectionConfig& lhs,
                  const QsConnectionConfig& rhs)
@@ -11,30 +31,77 @@ bool operator ==(const QsConnectionConfig& lhs,
     return lhs._threadMode == lhs._threadMode
             && lhs._openMode == rhs._openMode
             && lhs._cacheMode == rhs._cacheMode
+            && lhs._encoding == rhs._encoding
             && lhs._databaseName == rhs._databaseName
             && lhs._createSchemaScript == rhs._createSchemaScript
             && lhs._configConnectionScript == rhs._configConnectionScript
-            && lhs._collatorLocales == rhs._collatorLocales;
+            && lhs._collatorLocales == rhs._collatorLocales
+            && lhs._migrations == rhs._migrations
+            && lhs._warmUpOnStart == rhs._warmUpOnStart
+            && lhs._notifyRowChanges == rhs._notifyRowChanges
+            && lhs._warmUpObjects == rhs._warmUpObjects
+            && lhs._warmUpStatements == rhs._warmUpStatements
+            && lhs._statements == rhs._statements
+            && lhs._busyTimeout == rhs._busyTimeout
+            && lhs._checkpointThreshold == rhs._checkpointThreshold
+            && lhs._checkpointIdleTimeout == rhs._checkpointIdleTimeout
+            && lhs._resultCacheSize == rhs._resultCacheSize;
 }
 
 QsConnectionConfig::QsConnectionConfig(const QByteArray& dbName) Q_DECL_NOTHROW
     : _threadMode {QsConnection::defaultThreadMode},
       _openMode {QsConnection::defaultOpenMode},
       _cacheMode {QsConnection::defaultCacheMode},
+      _encoding {QsConnection::Utf8},
+      _warmUpOnStart {false},
+      _notifyRowChanges {false},
+      _busyTimeout {0},
+      _checkpointThreshold {0},
+      _checkpointIdleTimeout {1000},
+      _resultCacheSize {0},
       _databaseName {dbName}
 {}
 
+void QsConnectionConfig::addMigration(const int         version,
+                                      const QByteArray& script)
+{
+    // check version (zero is version of empty database)
+    if (version > 0) {
+        _migrations.insert(version, script);
+    }
+}
+
 void QsConnectionConfig::addUtf16Collator(const QByteArray& collationName,
                                           const QLocale&    locale)
 {
     _collatorLocales.insert(collationName, locale);
 }
 
+void QsConnectionConfig::addWarmUpObject(const QByteArray& name)
+{
+    _warmUpObjects.append(name);
+}
+
+void QsConnectionConfig::addWarmUpStatement(const QByteArray& query)
+{
+    _warmUpStatements.append(query);
+}
+
+int QsConnectionConfig::busyTimeout() const noexcept
+{
+    return _busyTimeout;
+}
+
 QByteArray QsConnectionConfig::databaseName() const Q_DECL_NOTHROW
 {
     return _databaseName;
 }
 
+void QsConnectionConfig::deleteMigration(const int version)
+{
+    _migrations.remove(version);
+}
+
 void QsConnectionConfig::deleteUtf16Collator(const QByteArray& collationName)
 {
     _collatorLocales.remove(collationName);
@@ -45,6 +112,16 @@ QsConnection::CacheMode QsConnectionConfig::cacheMode() const noexcept
     return _cacheMode;
 }
 
+int QsConnectionConfig::checkpointIdleTimeout() const noexcept
+{
+    return _checkpointIdleTimeout;
+}
+
+int QsConnectionConfig::checkpointThreshold() const noexcept
+{
+    return _checkpointThreshold;
+}
+
 QByteArray QsConnectionConfig::configConnectionScript() const Q_DECL_NOTHROW
 {
     return _configConnectionScript;
@@ -55,14 +132,38 @@ QByteArray QsConnectionConfig::createSchemaScript() const Q_DECL_NOTHROW
     return _createSchemaScript;
 }
 
-QByteArray QsConnectionConfig::lastError() const Q_DECL_NOTHROW
+QsConnection::Encoding QsConnectionConfig::encoding() const noexcept
 {
-    return _lastError;
+    return _encoding;
+}
+
+QByteArray QsConnectionConfig::lastError() const
+{
+    // messages are formatted on demand
+    QByteArray result;
+    for (const QsError& error : _lastErrors) {
+        if (!result.isEmpty()) {
+            result.append(' ');
+        }
+        result.append(error.message());
+    }
+
+    return result;
 }
 
 QString QsConnectionConfig::lastError16() const
 {
-    return QString::fromUtf8(_lastError);
+    return QString::fromUtf8(lastError());
+}
+
+QMap<int, QByteArray> QsConnectionConfig::migrations() const
+{
+    return _migrations;
+}
+
+bool QsConnectionConfig::notifyRowChanges() const noexcept
+{
+    return _notifyRowChanges;
 }
 
 QsConnection::OpenMode QsConnectionConfig::openMode() const noexcept
@@ -70,15 +171,20 @@ QsConnection::OpenMode QsConnectionConfig::openMode() const noexcept
     return _openMode;
 }
 
+qint64 QsConnectionConfig::resultCacheSize() const noexcept
+{
+    return _resultCacheSize;
+}
+
 int QsConnectionConfig::openAndConfig(QsConnection& connection)
 {
     int result = Ok;
-    QByteArrayList errors;
+    QVector<QsError> errors;
 
     // try construct and open connection (save error on fail)
     if (!tryOpen(connection)) {
-        errors.append(qs::buildConnErrMsg(
-                          "Error on open connection", connection));
+        errors.append(QsError::fromConnection("Error on open connection",
+                                              connection));
         result = OpenConnError;
     } else {
         // try add collations for locales (save errors on fail)
@@ -87,43 +193,77 @@ int QsConnectionConfig::openAndConfig(QsConnection& connection)
             result = CreateCollationError;
         }
 
-        // try create schema if needed (save error on fail);
-        // if create schema success, try execute script for
+        // try create or migrate schema if needed (save error on fail);
+        // if migration success, try execute script for
         // connection configuration (save error on fail)
-        if (!tryCreateSchema(connection)) {
-            errors.append(qs::buildConnErrMsg(
-                              "Error on create database schema", connection));
+        const QsError schemaError = migrateSchema(connection);
+        if (!schemaError.isEmpty()) {
+            errors.append(schemaError);
             result |= CreateSchemaError;
         } else if (!tryConfigureConnection(connection)) {
-            errors.append(qs::buildConnErrMsg(
+            errors.append(QsError::fromConnection(
                               "Error on configure connection", connection));
             result |= ConfigureConnError;
+        } else {
+            // try warm up configured connection (save errors on fail)
+            const QVector<QsError> warmUpErrors = warmUp(connection);
+            if (!warmUpErrors.isEmpty()) {
+                errors.append(warmUpErrors);
+                result |= WarmUpError;
+            }
         }
     }
 
-    // clear last error on success (otherwise, save new errors)
-    if (result == Ok) {
-        _lastError.clear();
-    } else {
-        _lastError = errors.join(' ');
-    }
+    // clear last errors on success (otherwise, save new errors)
+    _lastErrors = std::move(errors);
 
     // return result flags
     return result;
 }
 
+int QsConnectionConfig::registerStatement(const QByteArray& name,
+                                          const QByteArray& query)
+{
+    // replace query of registered statement
+    int handle = statementHandle(name);
+    if (handle >= 0) {
+        _statements[handle].second = query;
+    } else {
+        handle = _statements.size();
+        _statements.append(std::make_pair(name, query));
+    }
+
+    return handle;
+}
+
 void QsConnectionConfig::setDatabaseName(
         const QByteArray& databaseName) Q_DECL_NOTHROW
 {
     _databaseName = databaseName;
 }
 
+void QsConnectionConfig::setBusyTimeout(const int milliseconds) noexcept
+{
+    _busyTimeout = milliseconds;
+}
+
 void
 QsConnectionConfig::setCacheMode(const QsConnection::CacheMode value) noexcept
 {
     _cacheMode = value;
 }
 
+void QsConnectionConfig::setCheckpointIdleTimeout(
+        const int milliseconds) noexcept
+{
+    _checkpointIdleTimeout = milliseconds;
+}
+
+void QsConnectionConfig::setCheckpointThreshold(const int pages) noexcept
+{
+    _checkpointThreshold = pages;
+}
+
 void QsConnectionConfig::setConfigConnectionScript(
         const QByteArray& script) Q_DECL_NOTHROW
 {
@@ -136,18 +276,72 @@ void QsConnectionConfig::setCreateSchemaScript(
     _createSchemaScript = script;
 }
 
+void
+QsConnectionConfig::setEncoding(const QsConnection::Encoding value) noexcept
+{
+    _encoding = value;
+}
+
+void QsConnectionConfig::setNotifyRowChanges(const bool value) noexcept
+{
+    _notifyRowChanges = value;
+}
+
 void
 QsConnectionConfig::setOpenMode(const QsConnection::OpenMode value) noexcept
 {
     _openMode = value;
 }
 
+void QsConnectionConfig::setResultCacheSize(const qint64 bytes) noexcept
+{
+    _resultCacheSize = (bytes > 0) ? bytes : 0;
+}
+
 void
 QsConnectionConfig::setThreadMode(const QsConnection::ThreadMode value) noexcept
 {
     _threadMode = value;
 }
 
+int QsConnectionConfig::schemaVersion() const noexcept
+{
+    // version of last migration (or 1 for create schema script only)
+    if (!_migrations.isEmpty()) {
+        return std::max(_migrations.lastKey(),
+                        _createSchemaScript.isEmpty() ? 0 : 1);
+    }
+
+    return _createSchemaScript.isEmpty() ? 0 : 1;
+}
+
+void QsConnectionConfig::setWarmUpOnStart(const bool value) noexcept
+{
+    _warmUpOnStart = value;
+}
+
+int QsConnectionConfig::statementCount() const noexcept
+{
+    return _statements.size();
+}
+
+int QsConnectionConfig::statementHandle(const QByteArray& name) const noexcept
+{
+    for (int i = 0, count = _statements.size(); i < count; ++i) {
+        if (_statements[i].first == name) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+QByteArray QsConnectionConfig::statementQuery(const int handle) const
+{
+    return (handle >= 0 && handle < _statements.size())
+            ? _statements[handle].second : QByteArray();
+}
+
 QsConnection::ThreadMode QsConnectionConfig::threadMode() const noexcept
 {
     return _threadMode;
@@ -158,6 +352,21 @@ QHash<QByteArray, QLocale> QsConnectionConfig::utf16Collators() const
     return _collatorLocales;
 }
 
+QByteArrayList QsConnectionConfig::warmUpObjects() const
+{
+    return _warmUpObjects;
+}
+
+bool QsConnectionConfig::warmUpOnStart() const noexcept
+{
+    return _warmUpOnStart;
+}
+
+QByteArrayList QsConnectionConfig::warmUpStatements() const
+{
+    return _warmUpStatements;
+}
+
 bool QsConnectionConfig::tryConfigureConnection(
         QsConnection& connection) const noexcept
 {
@@ -166,10 +375,10 @@ bool QsConnectionConfig::tryConfigureConnection(
             || connection.execute(_configConnectionScript);
 }
 
-QByteArrayList
+QVector<QsError>
 QsConnectionConfig::createCollations(QsConnection& connection) const
 {
-    QByteArrayList errorList;
+    QVector<QsError> errorList;
 
     // try create collation and save errors to list
     // (if create some collations failed)
@@ -179,39 +388,182 @@ QsConnectionConfig::createCollations(QsConnection& connection) const
             // build error string and append it to list
             QByteArray error("Error on add collation \'");
             error.append(it.key()).append('\'');
-            errorList.append(qs::buildConnErrMsg(
-                                 error.constData(), connection));
+            errorList.append(connectionError(error, connection));
         }
     }
 
-    // return result string list
+    // return errors
     return errorList;
 }
 
-bool
-QsConnectionConfig::tryCreateSchema(QsConnection& connection) const noexcept
+QsError QsConnectionConfig::migrateSchema(QsConnection& connection) const
 {
-    // check if script to create database schema is not empty
-    if (!_createSchemaScript.isEmpty()) {
-        // read info from sqlite_master
-        const std::pair<qint64, int> dbInfo = connection.readInt64(
+    // database, created before migrations were used, has version 0 and
+    // non-empty schema, created by step of version 1 (create schema script
+    // or first migration), so it is treated as version 1
+    const bool hasFirstStep = !_createSchemaScript.isEmpty()
+            || _migrations.contains(1);
+    const auto readVersion = [&connection, hasFirstStep] (
+            qint64& version, bool& isLegacy) {
+        const std::pair<qint64, int> userVersion = connection.readInt64(
+                    QByteArrayLiteral("pragma user_version"));
+        if (userVersion.second != QsConnection::ReadSuccess) {
+            return QsError::fromConnection(
+                        "Error on read database schema version", connection);
+        }
+
+        version = userVersion.first;
+        isLegacy = false;
+        if (version == 0 && hasFirstStep) {
+            const std::pair<qint64, int> objectCount = connection.readInt64(
                     QByteArrayLiteral("select count(*) from sqlite_master"));
+            if (objectCount.second != QsConnection::ReadSuccess) {
+                return QsError::fromConnection(
+                            "Error on read database schema", connection);
+            }
 
-        // try create database schema if not exists and return result
-        return dbInfo.second == QsConnection::ReadSuccess
-                && (dbInfo.first == 0
-                    || connection.execute(_createSchemaScript));
+            isLegacy = objectCount.first > 0;
+            version = isLegacy ? 1 : 0;
+        }
+
+        return QsError();
+    };
+
+    // check if database schema is up to date (single read on each open);
+    // version of legacy database is saved once, if database is writable
+    // (read-only legacy database is detected again on each open)
+    const int targetVersion = schemaVersion();
+    qint64 version = 0;
+    bool isLegacy = false;
+    QsError error = readVersion(version, isLegacy);
+    if (!error.isEmpty()) {
+        return error;
+    } else if (version >= targetVersion
+               && (!isLegacy || connection.isReadOnly())) {
+        return QsError();
     }
 
-    return true;
+    // lock database for writing and re-read version (it may be changed
+    // by other connection, while this connection was waiting for lock)
+    if (!connection.execute(QByteArrayLiteral("begin immediate"))) {
+        return QsError::fromConnection(
+                    "Error on begin database schema migration", connection);
+    }
+
+    error = readVersion(version, isLegacy);
+
+    // apply missing migration steps in version order
+    if (error.isEmpty() && (version < targetVersion || isLegacy)) {
+        if (version < 1 && !_createSchemaScript.isEmpty()
+                && !_migrations.contains(1)
+                && !connection.execute(_createSchemaScript)) {
+            error = QsError::fromConnection(
+                        "Error on create database schema", connection);
+        }
+
+        for (auto it = _migrations.upperBound(static_cast<int>(version)),
+             end = _migrations.cend(); error.isEmpty() && it != end; ++it) {
+            if (!connection.execute(it.value())) {
+                error = connectionError(
+                            QByteArray("Error on migrate database schema to "
+                                       "version ").append(QByteArray::number(
+                                                              it.key())),
+                            connection);
+            }
+        }
+
+        // save new version
+        if (error.isEmpty() && !connection.execute(
+                    QByteArray("pragma user_version = ").append(
+                        QByteArray::number(std::max<qint64>(
+                                               version, targetVersion))))) {
+            error = QsError::fromConnection(
+                        "Error on save database schema version", connection);
+        }
+    }
+
+    // commit changes (or rollback all steps on fail) and return error
+    if (error.isEmpty() && !connection.commit()) {
+        error = QsError::fromConnection(
+                    "Error on commit database schema migration", connection);
+    }
+
+    if (!error.isEmpty()) {
+        connection.rollback();
+    }
+
+    return error;
 }
 
 bool QsConnectionConfig::tryOpen(QsConnection& connection) const
 {
-    // close db (if opened) and set database name,
+    // close db (if opened) and set database name and busy timeout
     connection.close();
     connection.setDatabaseName(_databaseName);
+    connection.setBusyTimeout(_busyTimeout);
 
-    // try open connection and return result
-    return connection.open(_openMode, _threadMode, _cacheMode);
+    // try open connection
+    if (!connection.open(_openMode, _threadMode, _cacheMode)) {
+        return false;
+    }
+
+    // set encoding of new database (UTF-8 is default encoding of sqlite,
+    // so pragma is not needed for it); existing database ignores pragma
+    if (_encoding != QsConnection::Utf8) {
+        connection.setEncoding(_encoding);
+    }
+
+    return true;
+}
+
+QVector<QsError> QsConnectionConfig::warmUp(QsConnection& connection) const
+{
+    QVector<QsError> errorList;
+
+    // compile hot statements into statement cache
+    for (const QByteArray& query : _warmUpStatements) {
+        if (!connection.prepareCached(query)) {
+            QByteArray error("Error on prepare statement \'");
+            error.append(query).append('\'');
+            errorList.append(connectionError(error, connection));
+        }
+    }
+
+    // read pages of tables and indexes into page cache (count() visits
+    // all pages of b-tree, which is forced by 'not indexed'/'indexed by')
+    for (const QByteArray& name : _warmUpObjects) {
+        const std::pair<QByteArray, int> type = connection.readString(
+                    QByteArrayLiteral("select type from sqlite_master "
+                                      "where name = ?"), name);
+        const std::pair<QByteArray, int> table = connection.readString(
+                    QByteArrayLiteral("select tbl_name from sqlite_master "
+                                      "where name = ?"), name);
+
+        QByteArray query;
+        if (type.second == QsConnection::ReadSuccess
+                && table.second == QsConnection::ReadSuccess) {
+            query = QByteArrayLiteral("select count(*) from ");
+            query.append(quotedName(table.first));
+            if (type.first == "index") {
+                query.append(" indexed by ").append(quotedName(name));
+            } else {
+                query.append(" not indexed");
+            }
+        }
+
+        if (type.second == QsConnection::EmptyData) {
+            QByteArray error("Error on warm up \'");
+            error.append(name).append("\' (no such table or index).");
+            errorList.append(QsError(error));
+        } else if (query.isEmpty()
+                   || connection.readInt64(query).second
+                   != QsConnection::ReadSuccess) {
+            QByteArray error("Error on warm up \'");
+            error.append(name).append('\'');
+            errorList.append(connectionError(error, connection));
+        }
+    }
+
+    // return errors
+    return errorList;
 }
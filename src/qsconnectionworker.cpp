@@ -1,41 +1,460 @@
 #include "../include/qsconnectionworker.h"
 
+#include <iterator>
+#include <list>
+
+#include <QHash>
 #include <QMetaType>
+#include <QTimer>
 
 #include "qshelper.h"
 
 namespace {
 
-static const int taskId = qRegisterMetaType<QsConnectionWorker::TaskPtr>();
+static const int rowChangesId =
+        qRegisterMetaType<QsConnection::RowChanges>();
 
-static const int onSuccessId =
-        qRegisterMetaType<QsConnectionWorker::StmtTaskPtr>();
+static const QByteArray emptyTaskErr =
+        QByteArrayLiteral("Error: task is empty.");
 
-static const int onErrroId =
-        qRegisterMetaType<QsConnectionWorker::ExecResultPtr>();
+static const QByteArray badHandleErr =
+        QByteArrayLiteral("Error: statement handle is not registered.");
 
-static const int handlerId =
-        qRegisterMetaType<QsConnectionWorker::HandlerPtr>();
+static const QByteArray paramCountErr =
+        QByteArrayLiteral("Error: count of parameters does not match "
+                          "statement.");
 
-static const QByteArray emptyTaskErr =
-        QByteArrayLiteral("Error: task is empty.");
+const char* const rollbackErr = "Error on rollback";
+
+// storage class of bound parameter (so parameters, which are bound
+// in the same way, give the same key of cached result)
+enum ParamKind {
+    NullParam = 0,
+    IntParam,
+    DoubleParam,
+    BlobParam,
+    TextParam
+};
+
+ParamKind paramKind(const QVariant& value) noexcept
+{
+    if (value.isNull()) {
+        return NullParam;
+    }
+
+    switch (value.userType()) {
+    case QMetaType::Bool:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+        return IntParam;
+    case QMetaType::Double:
+    case QMetaType::Float:
+        return DoubleParam;
+    case QMetaType::QByteArray:
+        return BlobParam;
+    default:
+        return TextParam;
+    }
+}
+
+bool bindParams(const QsStatement& statement, const QVariantList& params)
+{
+    for (int i = 0; i < params.size(); ++i) {
+        const QVariant& value = params.at(i);
+        bool bound = false;
+        switch (paramKind(value)) {
+        case NullParam:
+            bound = statement.bindNull(i + 1);
+            break;
+        case IntParam:
+            bound = statement.bindInt64(i + 1, value.toLongLong());
+            break;
+        case DoubleParam:
+            bound = statement.bindDouble(i + 1, value.toDouble());
+            break;
+        case BlobParam:
+            bound = statement.bindBlobShared(i + 1, value.toByteArray());
+            break;
+        case TextParam:
+            bound = statement.bindTextCopy(i + 1, value.toString());
+            break;
+        }
+
+        if (!bound) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<typename T>
+inline void appendRaw(QByteArray& key, const T value)
+{
+    key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// key of cached result: statement handle and kind and value of each
+// parameter (text is kept in UTF-16, so it is not converted)
+QByteArray resultKey(const int statementHandle, const QVariantList& params)
+{
+    QByteArray key;
+    appendRaw(key, statementHandle);
+    for (const QVariant& value : params) {
+        const ParamKind kind = paramKind(value);
+        key.append(static_cast<char>(kind));
+        switch (kind) {
+        case NullParam:
+            break;
+        case IntParam:
+            appendRaw(key, value.toLongLong());
+            break;
+        case DoubleParam:
+            appendRaw(key, value.toDouble());
+            break;
+        case BlobParam: {
+            const QByteArray bytes = value.toByteArray();
+            appendRaw(key, bytes.size());
+            key.append(bytes);
+            break;
+        }
+        case TextParam: {
+            const QString text = value.toString();
+            appendRaw(key, text.size());
+            key.append(reinterpret_cast<const char*>(text.constData()),
+                       text.size() * static_cast<int>(sizeof(QChar)));
+            break;
+        }
+        }
+    }
+
+    return key;
+}
+
+// estimated memory of result (size of custom types is not known, so they
+// are counted as QVariant only)
+qint64 variantBytes(const QVariant& value)
+{
+    qint64 bytes = sizeof(QVariant);
+    switch (value.userType()) {
+    case QMetaType::QByteArray:
+        bytes += value.toByteArray().size();
+        break;
+    case QMetaType::QString:
+        bytes += value.toString().size() * qint64(sizeof(QChar));
+        break;
+    case QMetaType::QVariantList:
+        for (const QVariant& item : value.toList()) {
+            bytes += variantBytes(item);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return bytes;
+}
 
-const char* rollbackErr = "Error on rollback";
+}
+
+// results of registered read-only statements in LRU order; results are
+// dropped, when changed rows of worker connection are delivered for
+// tables, which statement reads, and all results are dropped, when
+// database version is changed by other connection, or worker connection
+// changes rows, which are not seen by update hook
+struct QsConnectionWorker::ResultCache
+{
+    struct Entry {
+        QByteArray key;
+        QVariant   value;
+        int        statementHandle;
+        qint64     bytes;
+    };
+
+    using Entries = std::list<Entry>;
+
+    // tables of registered statement (they are read once; statement,
+    // which is not read-only or whose tables are unknown, is not cached)
+    struct StatementInfo {
+        bool                    known     {false};
+        bool                    cacheable {false};
+        bool                    stale     {false};
+        QsStatement::TableNames tables;
+    };
+
+    const qint64          maxBytes;
+    ResultCacheStatistics statistics;
+
+    Entries                              entries;  // recently used first
+    QHash<QByteArray, Entries::iterator> index;
+
+    std::vector<StatementInfo> statements;  // indexed by handle
+
+    // state of database, which cached results belong to
+    QsStatement dataVersionStatement;
+    QsStatement schemaVersionStatement;
+    qint64      dataVersion    {-1};
+    qint64      schemaVersion  {-1};
+    int         totalChanges   {0};
+    int         trackedChanges {0};  // changes, delivered by update hook
+
+    explicit ResultCache(const qint64 bytes) noexcept
+        : maxBytes {bytes}
+    {}
+
+    void clear() noexcept;
+
+    // release statement of connection (before connection is closed)
+    void reset() noexcept;
+
+    void erase(Entries::iterator it) noexcept;
+
+    bool find(const QByteArray& key, QVariant& value);
+
+    void insert(QByteArray&& key, int statementHandle, const QVariant& value);
+
+    void invalidate(const QsConnection::RowChanges& changes) noexcept;
+
+    bool isCacheable(int statementHandle, const QsStatement& statement);
+
+    void sync(const QsConnection& connection) noexcept;
+
+    // read value of pragma by statement, compiled on first use (or -1)
+    static qint64 readPragma(QsStatement&        statement,
+                             const QsConnection& connection,
+                             const QByteArray&   pragma) noexcept;
+};
 
+void QsConnectionWorker::ResultCache::clear() noexcept
+{
+    index.clear();
+    entries.clear();
+    statistics.bytes = 0;
+    statistics.entries = 0;
+}
+
+void QsConnectionWorker::ResultCache::reset() noexcept
+{
+    clear();
+    dataVersionStatement = QsStatement();
+    schemaVersionStatement = QsStatement();
+    dataVersion = -1;
+    schemaVersion = -1;
+    totalChanges = 0;
+    trackedChanges = 0;
+}
+
+void QsConnectionWorker::ResultCache::erase(Entries::iterator it) noexcept
+{
+    statistics.bytes -= it->bytes;
+    --statistics.entries;
+    index.remove(it->key);
+    entries.erase(it);
+}
+
+bool QsConnectionWorker::ResultCache::find(const QByteArray& key,
+                                           QVariant&         value)
+{
+    auto it = index.constFind(key);
+    if (it == index.cend()) {
+        ++statistics.misses;
+        return false;
+    }
+
+    // move entry to front of LRU list
+    entries.splice(entries.begin(), entries, it.value());
+    value = entries.front().value;
+    ++statistics.hits;
+
+    return true;
 }
 
+void QsConnectionWorker::ResultCache::insert(QByteArray&&    key,
+                                             const int       statementHandle,
+                                             const QVariant& value)
+{
+    // skip result, which is bigger than cache
+    const qint64 bytes = qint64(sizeof(Entry)) + key.size()
+            + variantBytes(value);
+    if (bytes > maxBytes) {
+        return;
+    }
+
+    entries.push_front(Entry {std::move(key), value, statementHandle, bytes});
+    try {
+        index.insert(entries.front().key, entries.begin());
+    } catch (...) {
+        entries.pop_front();
+        throw;
+    }
+
+    statistics.bytes += bytes;
+    ++statistics.entries;
+
+    // drop least recently used results
+    while (statistics.bytes > maxBytes) {
+        erase(std::prev(entries.end()));
+    }
+}
+
+void QsConnectionWorker::ResultCache::invalidate(
+        const QsConnection::RowChanges& changes) noexcept
+{
+    trackedChanges += changes.size();
+    if (entries.empty()) {
+        return;
+    }
+
+    // mark statements, which read changed tables (changes of the same
+    // table follow each other usually, so table is checked once for them)
+    const QsConnection::RowChange* previous = nullptr;
+    for (const QsConnection::RowChange& change : changes) {
+        if (change.operation == QsConnection::UntrackedChange) {
+            clear();
+            return;
+        }
+
+        if (previous && change.table == previous->table
+                && change.database == previous->database) {
+            continue;
+        }
+        previous = &change;
+
+        for (StatementInfo& info : statements) {
+            for (const QsStatement::TableName& name : info.tables) {
+                if (name.table == change.table
+                        && name.database == change.database) {
+                    info.stale = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // drop results of marked statements
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (statements[it->statementHandle].stale) {
+            erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    for (StatementInfo& info : statements) {
+        info.stale = false;
+    }
+}
+
+bool QsConnectionWorker::ResultCache::isCacheable(
+        const int          statementHandle,
+        const QsStatement& statement)
+{
+    if (statementHandle >= static_cast<int>(statements.size())) {
+        statements.resize(statementHandle + 1);
+    }
+
+    StatementInfo& info = statements[statementHandle];
+    if (!info.known) {
+        info.cacheable = statement.type() == QsStatement::Select
+                && statement.readTables(info.tables);
+        info.known = true;
+    }
+
+    return info.cacheable;
+}
+
+void QsConnectionWorker::ResultCache::sync(
+        const QsConnection& connection) noexcept
+{
+    // read version of database, which is changed by commits of other
+    // connections, and version of schema, which is changed by schema
+    // changes of any connection (they are not seen by update hook, and
+    // statements may read other tables after them)
+    const qint64 version = readPragma(dataVersionStatement, connection,
+                                      QByteArrayLiteral("pragma data_version"));
+    const qint64 schema = readPragma(
+                schemaVersionStatement, connection,
+                QByteArrayLiteral("pragma schema_version"));
+    const bool schemaChanged = schema < 0 || schema != schemaVersion;
+    if (schemaChanged) {
+        for (StatementInfo& info : statements) {
+            info.known = false;
+        }
+    }
+
+    // changes of worker connection, which are not delivered by update hook
+    // (e.g. delete of all rows, changes of WITHOUT ROWID table or rolled
+    // back changes), may change any table
+    const int total = connection.totalChanges();
+    const bool untrackedChanges = static_cast<unsigned>(total - totalChanges)
+            > static_cast<unsigned>(trackedChanges);
+
+    if (version < 0 || version != dataVersion || schemaChanged
+            || untrackedChanges) {
+        clear();
+    }
+
+    dataVersion = version;
+    schemaVersion = schema;
+    totalChanges = total;
+    trackedChanges = 0;
+}
+
+qint64 QsConnectionWorker::ResultCache::readPragma(
+        QsStatement&        statement,
+        const QsConnection& connection,
+        const QByteArray&   pragma) noexcept
+{
+    if (!statement.isValid()) {
+        statement = QsStatement(connection, pragma);
+    }
+
+    qint64 value = -1;
+    if (statement.isValid() && statement.next()) {
+        value = statement.getInt64(0);
+    }
+    statement.rewind();
+
+    return value;
+}
+
+
 
 QsConnectionWorker::QsConnectionWorker(const QsConnectionConfig& config,
                                        QObject*                  parent)
-    : QObject(parent),
-      _connectionConfig {config}
+    : QsConnectionWorker(QsConnectionConfig(config), parent)
 {}
 
 QsConnectionWorker::QsConnectionWorker(QsConnectionConfig&& config,
                                        QObject*             parent)
     : QObject(parent),
-      _connectionConfig {std::move(config)}
-{}
+      _connectionConfig {std::move(config)},
+      _resultCache {_connectionConfig.resultCacheSize() > 0
+                    ? new ResultCache(_connectionConfig.resultCacheSize())
+                    : nullptr},
+      _checkpointTimer {new QTimer(this)},
+      _checkpointScheduled {false},
+      _walChanged {false}
+{
+    // truncate WAL, when there are no commits for idle timeout
+    _checkpointTimer->setSingleShot(true);
+    connect(_checkpointTimer, &QTimer::timeout, this, [this] () {
+        checkpoint(QsConnection::TruncateCheckpoint);
+    });
+}
+
+QsConnectionWorker::~QsConnectionWorker() = default;
+
+void QsConnectionWorker::clearResultCache() noexcept
+{
+    if (_resultCache) {
+        _resultCache->reset();
+    }
+}
 
 QsConnectionWorker::ExecResult
 QsConnectionWorker::exec(const Task& task) Q_DECL_NOTHROW
@@ -43,6 +462,7 @@ QsConnectionWorker::exec(const Task& task) Q_DECL_NOTHROW
     ExecResult result;
 
     tryRunTask(task, result);
+    flushRowChanges();
 
     return result;
 }
@@ -55,119 +475,279 @@ QsConnectionWorker::exec(const StmtTask&   task,
     ExecResult result;
 
     tryRunStmtTask(task, query, result, inTransaction);
+    flushRowChanges();
+
+    return result;
+}
+
+QsConnectionWorker::ExecResult
+QsConnectionWorker::exec(const PreparedTask& task,
+                         const int           statementHandle,
+                         const bool          inTransaction) Q_DECL_NOTHROW
+{
+    ExecResult result;
+
+    tryRunPreparedTask(task, statementHandle, result, inTransaction);
+    flushRowChanges();
+
+    return result;
+}
+
+QsConnectionWorker::ExecResult
+QsConnectionWorker::execCached(const PreparedTask& task,
+                               const int           statementHandle,
+                               const QVariantList& params) Q_DECL_NOTHROW
+{
+    ExecResult result;
+
+    tryRunCachedTask(task, statementHandle, params, result);
+    flushRowChanges();
 
     return result;
 }
 
 bool QsConnectionWorker::openConnection()
 {
-    return _connection.isOpen() || _connectionConfig.openAndConfig(_connection)
+    // check if connection is open
+    if (_connection.isOpen()) {
+        return true;
+    }
+
+    // try open and configure connection
+    const bool result = _connectionConfig.openAndConfig(_connection)
             == QsConnectionConfig::ResultCode::Ok;
+
+    // take checkpoints out of commits, if needed
+    if (_connection.isOpen() && _connectionConfig.checkpointThreshold() > 0) {
+        _connection.setWalHook(onWalCommit, this);
+    }
+
+    // drop cached results of changed tables and emit committed row
+    // changes, if needed (signal is queued to QsConnectionAsyncWorker,
+    // so handler does not use connection)
+    if (_connection.isOpen()
+            && (_resultCache || _connectionConfig.notifyRowChanges())) {
+        _connection.setRowChangeHandler(
+                    [this] (const QsConnection::RowChanges& changes) {
+            if (_resultCache) {
+                _resultCache->invalidate(changes);
+            }
+            if (_connectionConfig.notifyRowChanges()) {
+                emit rowsChanged(changes);
+            }
+        });
+    }
+
+    return result;
 }
 
+void QsConnectionWorker::setJobQueue(
+        std::shared_ptr<qs::JobQueue> jobQueue) noexcept
+{
+    _jobQueue = std::move(jobQueue);
+}
 
+void QsConnectionWorker::warmUp() Q_DECL_NOTHROW
+{
+    QByteArray errorMsg;
 
-void QsConnectionWorker::execWithData(TaskPtr  taskPtr,
-                                      QVariant data) Q_DECL_NOTHROW
+    try {
+        // try open connection and save error on fail
+        if (!openConnection()) {
+            errorMsg = _connectionConfig.lastError();
+        }
+    } catch (const std::exception& exception) {
+        try {
+            errorMsg = exception.what();
+        } catch (...) {
+            errorMsg = qs::badAllocErrMsg;
+        }
+    } catch (...) {
+        errorMsg = qs::unknownExceptionErrMsg;
+    }
+
+    // emit signal with error message
+    if (!errorMsg.isEmpty()) {
+        emit error(std::move(errorMsg));
+    }
+}
+
+void QsConnectionWorker::processJobs() Q_DECL_NOTHROW
 {
-    // check if pointer to task is not null
-    if (taskPtr) {
-        // execute task
-        ExecResult result = exec(*taskPtr.get());
+    // check if job queue exists
+    if (!_jobQueue) {
+        return;
+    }
 
-        // process result
-        processExecResultWithData(result, data);
-    } else {
-        emit errorWithData(emptyTaskErr, std::move(data));
+    // run queued jobs in order of submission
+    bool wakeUpAsyncWorker = false;
+    _jobQueue->jobs.consume([this, &wakeUpAsyncWorker] (qs::Job& job) {
+        ExecResult result;
+        switch (job.kind) {
+        case qs::Job::RunTask:
+            tryRunTask(job.task, result);
+            break;
+        case qs::Job::RunStmtTask:
+            tryRunStmtTask(job.stmtTask, job.query, result,
+                           job.inTransaction);
+            break;
+        case qs::Job::RunPreparedTask:
+            tryRunPreparedTask(job.preparedTask, job.statementHandle, result,
+                               job.inTransaction);
+            break;
+        case qs::Job::RunCachedTask:
+            tryRunCachedTask(job.preparedTask, job.statementHandle,
+                             job.params, result);
+            break;
+        }
+        flushRowChanges();
+
+        // deliver result
+        switch (job.delivery) {
+        case qs::Job::DeliverData:
+            processExecResultWithData(result, job.data);
+            break;
+        case qs::Job::HandleInWorkerThread:
+            qs::processExecResult(&result, job.handler.get());
+            break;
+        case qs::Job::HandleInObjectThread:
+            try {
+                // async worker is woken up once for batch of results
+                wakeUpAsyncWorker |= _jobQueue->results.push(
+                            qs::JobResult {std::move(result),
+                                           std::move(job.handler)});
+            } catch (...) {
+                emit error(qs::badAllocErrMsg);
+            }
+            break;
+        }
+    });
+
+    if (wakeUpAsyncWorker) {
+        emit resultsQueued();
     }
 }
 
-void QsConnectionWorker::execWithHandler(TaskPtr    taskPtr,
-                                         HandlerPtr handlerPtr,
-                                         const bool runHandler) Q_DECL_NOTHROW
+bool QsConnectionWorker::beginTransaction(const QsStatement& statement,
+                                          ExecResult&        result)
+Q_DECL_NOTHROW
 {
-    // check if pointer to task is not null
-    if (taskPtr) {
-        // execute task
-        ExecResult result = exec(*taskPtr.get());
+    // try begin transaction (or save error)
+    if (!_connection.transaction(statement.type() == QsStatement::Select
+                                 ? QsConnection::Deferred
+                                 : QsConnection::Immediate)) {
+        result.second = QsError::fromConnection(
+                    "Error on begin transaction", _connection);
+        return false;
+    }
 
-        // process result
-        processExecResultWithHandler(result, handlerPtr, runHandler);
-    } else {
-        emit error(emptyTaskErr);
+    return true;
+}
+
+void QsConnectionWorker::endTransaction(const bool  commitChanges,
+                                        ExecResult& result) Q_DECL_NOTHROW
+{
+    // try commit (or rollback) and save error on fail
+    if (commitChanges) {
+        if (!_connection.commit()) {
+            result.second = QsError::fromConnection("Error on commit",
+                                                    _connection);
+        }
+    } else if (!_connection.rollback()) {
+        result.second = QsError::fromConnection(rollbackErr, _connection);
     }
 }
 
-void QsConnectionWorker::execStatementWithData(StmtTaskPtr stmtPtr,
-                                               QByteArray  query,
-                                               bool        inTransaction,
-                                               QVariant    data) Q_DECL_NOTHROW
+void QsConnectionWorker::checkpoint(
+        const QsConnection::CheckpointMode mode) Q_DECL_NOTHROW
 {
-    // check if pointer to statement task is not null
-    if (stmtPtr) {
-        // execute task
-        ExecResult result = exec(*stmtPtr.get(), query, inTransaction);
+    _checkpointScheduled = false;
 
-        // process result
-        processExecResultWithData(result, data);
-    } else {
-        emit errorWithData(emptyTaskErr, std::move(data));
+    // check if connection is open and WAL is changed
+    if (!_connection.isOpen() || !_walChanged) {
+        return;
+    }
+
+    // run checkpoint (WAL is not changed, only if it is truncated)
+    int walFrames = 0;
+    int checkpointedFrames = 0;
+    if (_connection.checkpoint(mode, &walFrames, &checkpointedFrames)
+            && mode == QsConnection::TruncateCheckpoint) {
+        _walChanged = false;
     }
 }
 
-void QsConnectionWorker::execStatementWithHandler(
-        StmtTaskPtr stmtPtr,
-        QByteArray  query,
-        bool        inTransaction,
-        HandlerPtr  handlerPtr,
-        bool        runHandler) Q_DECL_NOTHROW
+int QsConnectionWorker::onWalCommit(void* const worker,
+                                    sqlite3*,
+                                    const char*,
+                                    const int   pages) Q_DECL_NOTHROW
 {
-    // check if pointer to task is not null
-    if (stmtPtr) {
-        // execute task
-        ExecResult result = exec(*stmtPtr.get(), query, inTransaction);
+    QsConnectionWorker* self = static_cast<QsConnectionWorker*>(worker);
+    self->_walChanged = true;
+
+    // schedule passive checkpoint after queued tasks, if WAL is big
+    // (checkpoint can not run in hook, because it is called on commit)
+    if (pages >= self->_connectionConfig.checkpointThreshold()
+            && !self->_checkpointScheduled) {
+        self->_checkpointScheduled = true;
+        QTimer::singleShot(0, self, [self] () {
+            self->checkpoint(QsConnection::PassiveCheckpoint);
+        });
+    }
 
-        // process result
-        processExecResultWithHandler(result, handlerPtr, runHandler);
-    } else {
-        emit error(emptyTaskErr);
+    // restart idle timer
+    if (self->_connectionConfig.checkpointIdleTimeout() > 0) {
+        self->_checkpointTimer->start(
+                    self->_connectionConfig.checkpointIdleTimeout());
     }
+
+    return SQLITE_OK;
 }
 
-void QsConnectionWorker::processExecResultWithHandler(
-        ExecResult& result,
-        HandlerPtr& handlerPtr,
-        const bool  runHandler) Q_DECL_NOTHROW
+QsError QsConnectionWorker::openError() const
 {
-    // check if need run handler (otherwise resend it)
-    if (runHandler) {
-        qs::processExexResult(&result, handlerPtr);
-    } else {
-        // create std::shared_ptr from ExecResult (and catch exceptions)
-        ExecResultPtr resultPtr;
-        QByteArray onThrowMsg;
-        try {
-            resultPtr = std::make_shared<QsConnectionWorker::ExecResult>
-                    (std::move(result.first), std::move(result.second));
-        } catch (const std::exception& exception) {
-            try {
-                onThrowMsg = exception.what();
-            } catch (...) {
-                onThrowMsg = qs::badAllocErrMsg;
-            }
-        } catch (...) {
-            onThrowMsg = qs::unknownExceptionErrMsg;
-        }
+    // connection keeps sqlite error code of failed operation
+    return QsError(QsError::ConfigError, _connectionConfig.lastError(),
+                   _connection.lastExtendedErrorCode());
+}
 
-        // check if no error message while creating ExecResultPtr
-        if (onThrowMsg.isEmpty()) {
-            // resend result and handler smart pointers
-            emit executed(std::move(resultPtr), std::move(handlerPtr));
-        } else {
-            // emit signal with error message
-            emit error(std::move(onThrowMsg));
-        }
+void QsConnectionWorker::flushRowChanges() Q_DECL_NOTHROW
+{
+    try {
+        _connection.flushRowChanges();
+    } catch (...) {
+        emit error(qs::badAllocErrMsg);
+    }
+}
+
+QsConnectionWorker::ResultCacheStatistics
+QsConnectionWorker::resultCacheStatistics() const noexcept
+{
+    return _resultCache ? _resultCache->statistics : ResultCacheStatistics();
+}
+
+const QsStatement*
+QsConnectionWorker::preparedStatement(const int statementHandle)
+{
+    // check handle
+    if (statementHandle < 0
+            || statementHandle >= _connectionConfig.statementCount()) {
+        return nullptr;
+    }
+
+    // create array of statements on first use
+    if (_statements.empty()) {
+        _statements.resize(_connectionConfig.statementCount());
     }
+
+    // compile statement on first use
+    QsStatement& statement = _statements[statementHandle];
+    if (!statement.isValid()) {
+        statement = _connection.prepare(
+                    _connectionConfig.statementQuery(statementHandle));
+    }
+
+    return &statement;
 }
 
 void
@@ -178,7 +758,146 @@ QsConnectionWorker::processExecResultWithData(ExecResult& result,
     if (result.second.isEmpty()) {
         emit finished(std::move(result.first), std::move(data));
     } else {
-        emit errorWithData(std::move(result.second), std::move(data));
+        emit errorWithData(result.second.message(), std::move(data));
+    }
+}
+
+void QsConnectionWorker::tryRunPreparedTask(
+        const PreparedTask& task,
+        const int           statementHandle,
+        ExecResult&         result,
+        const bool          inTransaction) Q_DECL_NOTHROW
+{
+    // check if task is not empty
+    if (!task) {
+        result.second = QsError(QsError::TaskError, emptyTaskErr);
+        return;
+    }
+
+    try {
+        // check if connection is open (and try open it, if it is closed)
+        if (!openConnection()) {
+            result.second = openError();
+            return;
+        }
+
+        // get compiled statement (compile it, if it is not compiled yet)
+        const QsStatement* statement = preparedStatement(statementHandle);
+        if (!statement) {
+            result.second = QsError(QsError::TaskError, badHandleErr);
+            return;
+        } else if (!statement->isValid()) {
+            result.second = QsError::fromConnection(
+                        "Error on compile statement", _connection);
+            return;
+        }
+
+        // try begin transaction, if needed (or save error and return)
+        if (inTransaction && !beginTransaction(*statement, result)) {
+            return;
+        }
+
+        // try run task and reset statement (even if task throws)
+        bool commitChanges = true;
+        try {
+            result.first = task(*statement, commitChanges);
+        } catch (...) {
+            statement->rewind();
+            statement->clearBindings();
+            if (inTransaction) {
+                _connection.rollback();
+            }
+            throw;
+        }
+
+        statement->rewind();
+        statement->clearBindings();
+
+        // check if need commit (or rollback) try do it
+        if (inTransaction) {
+            endTransaction(commitChanges, result);
+        }
+    } catch (const std::exception& exception) {
+        try {
+            result.second = QsError(QsError::ExceptionError,
+                                    QByteArray(exception.what()));
+        } catch (...) {
+            result.second = QsError(QsError::ExceptionError,
+                                    qs::badAllocErrMsg);
+        }
+    } catch (...) {
+        result.second = QsError(QsError::ExceptionError,
+                                qs::unknownExceptionErrMsg);
+    }
+}
+
+void QsConnectionWorker::tryRunCachedTask(
+        const PreparedTask& task,
+        const int           statementHandle,
+        const QVariantList& params,
+        ExecResult&         result) Q_DECL_NOTHROW
+{
+    // check if task is not empty
+    if (!task) {
+        result.second = QsError(QsError::TaskError, emptyTaskErr);
+        return;
+    }
+
+    try {
+        // find cached result (errors of connection and statement are
+        // left to prepared task)
+        QByteArray key;
+        if (_resultCache && openConnection()) {
+            // cache is synced first, so tables of statements are read again
+            // after schema change
+            const QsStatement* statement = preparedStatement(statementHandle);
+            if (statement && statement->isValid()) {
+                _resultCache->sync(_connection);
+            }
+            if (statement && statement->isValid()
+                    && _resultCache->isCacheable(statementHandle,
+                                                 *statement)) {
+                key = resultKey(statementHandle, params);
+                if (_resultCache->find(key, result.first)) {
+                    return;
+                }
+            }
+        }
+
+        // run task with bound parameters in read transaction
+        QsError bindError;
+        const PreparedTask boundTask =
+            [&task, &params, &bindError, this] (const QsStatement& statement,
+                                                bool& commitChanges) {
+                if (params.size() != statement.bindCount()) {
+                    bindError = QsError(QsError::TaskError, paramCountErr);
+                    return QVariant();
+                } else if (!bindParams(statement, params)) {
+                    bindError = QsError::fromConnection(
+                                "Error on bind parameters", _connection);
+                    return QVariant();
+                }
+                return task(statement, commitChanges);
+            };
+        tryRunPreparedTask(boundTask, statementHandle, result, true);
+
+        if (!bindError.isEmpty()) {
+            result.second = std::move(bindError);
+        } else if (!key.isEmpty() && result.second.isEmpty()) {
+            _resultCache->insert(std::move(key), statementHandle,
+                                 result.first);
+        }
+    } catch (const std::exception& exception) {
+        try {
+            result.second = QsError(QsError::ExceptionError,
+                                    QByteArray(exception.what()));
+        } catch (...) {
+            result.second = QsError(QsError::ExceptionError,
+                                    qs::badAllocErrMsg);
+        }
+    } catch (...) {
+        result.second = QsError(QsError::ExceptionError,
+                                qs::unknownExceptionErrMsg);
     }
 }
 
@@ -190,36 +909,29 @@ void QsConnectionWorker::tryRunStmtTask(
 {
     // check if task is not empty
     if (!stmtTask) {
-        result.second = emptyTaskErr;
+        result.second = QsError(QsError::TaskError, emptyTaskErr);
         return;
     }
 
     try {
         // check if connection is open (and try open it, if it is closed)
         if (!openConnection()) {
-            result.second = _connectionConfig.lastError();
-            return;
-        }
-
-        // try begin transaction, if needed (or save error and return)
-        if (inTransaction && !_connection.transaction()) {
-            result.second = qs::buildConnErrMsg(
-                        "Error on begin transaction", _connection);
+            result.second = openError();
             return;
         }
 
         // try compile statement
         QsStatement statement(_connection, query);
         if (!statement.isValid()) {
-            // save error
-            result.second = qs::buildConnErrMsg("Error on compile statement",
-                                                _connection);
-
-            // rollback transaction, if started, and save error, if occurred
-            if (inTransaction && !_connection.rollback()) {
-                result.second.append(' ')
-                        .append(qs::buildConnErrMsg(rollbackErr, _connection));
-            }
+            result.second = QsError::fromConnection(
+                        "Error on compile statement", _connection);
+            return;
+        }
+
+        // try begin transaction, if needed (or save error and return);
+        // write transaction takes write lock at once (immediate), so it
+        // does not fail with busy error on lock upgrade
+        if (inTransaction && !beginTransaction(statement, result)) {
             return;
         }
 
@@ -229,23 +941,19 @@ void QsConnectionWorker::tryRunStmtTask(
 
         // check if need commit (or rollback) try do it
         if (inTransaction) {
-            if (commitChanges) {
-                if (!_connection.commit()) {
-                    result.second = qs::buildConnErrMsg("Error on commit",
-                                                        _connection);
-                }
-            } else if (!_connection.rollback()) {
-                 result.second = qs::buildConnErrMsg(rollbackErr, _connection);
-            }
+            endTransaction(commitChanges, result);
         }
     } catch (const std::exception& exception) {
         try {
-            result.second = exception.what();
+            result.second = QsError(QsError::ExceptionError,
+                                    QByteArray(exception.what()));
         } catch (...) {
-            result.second = qs::badAllocErrMsg;
+            result.second = QsError(QsError::ExceptionError,
+                                    qs::badAllocErrMsg);
         }
     } catch (...) {
-        result.second = qs::unknownExceptionErrMsg;
+        result.second = QsError(QsError::ExceptionError,
+                                qs::unknownExceptionErrMsg);
     }
 }
 
@@ -254,7 +962,7 @@ void QsConnectionWorker::tryRunTask(const Task& task,
 {
     // check if task is not empty
     if (!task) {
-        result.second = emptyTaskErr;
+        result.second = QsError(QsError::TaskError, emptyTaskErr);
         return;
     }
 
@@ -263,15 +971,18 @@ void QsConnectionWorker::tryRunTask(const Task& task,
         if (openConnection()) {
             result.first = task(_connection);
         } else {
-            result.second = _connectionConfig.lastError();
+            result.second = openError();
         }
     } catch (const std::exception& exception) {
         try {
-            result.second = exception.what();
+            result.second = QsError(QsError::ExceptionError,
+                                    QByteArray(exception.what()));
         } catch (...) {
-            result.second = qs::badAllocErrMsg;
+            result.second = QsError(QsError::ExceptionError,
+                                    qs::badAllocErrMsg);
         }
     } catch (...) {
-        result.second = qs::unknownExceptionErrMsg;
+        result.second = QsError(QsError::ExceptionError,
+                                qs::unknownExceptionErrMsg);
     }
 }
@@ -0,0 +1,90 @@
+#include "../include/qserror.h"
+
+#include <cstring>
+#include <utility>
+
+#include "../include/qsconnection.h"
+#include "../include/sqlite3.h"
+
+QsError::QsError() noexcept
+    : _category {NoError},
+      _code {0},
+      _context {nullptr}
+{}
+
+QsError::QsError(const QByteArray& message)
+    : _category {message.isEmpty() ? NoError : OtherError},
+      _code {0},
+      _context {nullptr},
+      _details {message}
+{}
+
+QsError::QsError(const Category    category,
+                 const QByteArray& message,
+                 const int         code)
+    : _category {category},
+      _code {code},
+      _context {nullptr},
+      _details {message}
+{}
+
+QsError::QsError(const Category    category,
+                 const char* const context,
+                 const int         code,
+                 QByteArray        details) noexcept
+    : _category {category},
+      _code {code},
+      _context {context},
+      _details {std::move(details)}
+{}
+
+QsError QsError::fromConnection(const char* const   context,
+                                const QsConnection& connection)
+{
+    const int code = connection.lastExtendedErrorCode();
+    QsError result(SqliteError, context, code);
+
+    // save connection error message, only if it is not generic message
+    // of error code (e.g. it contains name of missing table)
+    if (connection._db) {
+        const char* message = sqlite3_errmsg(connection._db);
+        if (message && std::strcmp(message, sqlite3_errstr(code)) != 0) {
+            result._details = message;
+        }
+    } else {
+        result._details = connection.lastError();
+    }
+
+    return result;
+}
+
+bool QsError::isBusy() const noexcept
+{
+    const int primary = primaryCode();
+    return (_category == SqliteError || _category == ConfigError)
+            && (primary == SQLITE_BUSY || primary == SQLITE_LOCKED);
+}
+
+QByteArray QsError::message() const
+{
+    // message without context is saved as is
+    if (!_context) {
+        return _details;
+    }
+
+    QByteArray result(_context);
+
+    // sqlite error message is formatted as "context (details)."
+    if (_category == SqliteError) {
+        const char* details = _details.isEmpty() ? sqlite3_errstr(_code)
+                                                 : _details.constData();
+        if (details && *details) {
+            result.append(" (").append(details).append(')');
+        }
+        result.append('.');
+    } else if (!_details.isEmpty()) {
+        result.append(' ').append(_details);
+    }
+
+    return result;
+}
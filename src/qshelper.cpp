@@ -1,18 +1,156 @@
 #include "qshelper.h"
 
-QByteArray qs::processExexResult(
+#include <cstring>
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+QsStatement::QueryPlan qs::readQueryPlan(sqlite3* const   db,
+                                         const char* const query)
+{
+    QsStatement::QueryPlan plan;
+
+    // compile plan statement (plan does not depend on bound values)
+    const QByteArray planQuery = QByteArray("explain query plan ") + query;
+    sqlite3_stmt* stmt = NULL;
+    if (qs::blockingPrepare(db, planQuery.constData(), planQuery.length(),
+                            0, &stmt) != SQLITE_OK || !stmt) {
+        return plan;
+    }
+
+    // columns are (id, parent, notused, detail) since sqlite 3.24,
+    // and (selectid, order, from, detail) in older versions
+    const bool isTree = sqlite3_column_count(stmt) == 4
+            && std::strcmp(sqlite3_column_name(stmt, 0), "id") == 0;
+
+    QHash<int, int> nodeIndexes;  // node id -> index in plan
+    while (qs::blockingStep(stmt) == SQLITE_ROW) {
+        int parent = -1;
+        if (isTree) {
+            nodeIndexes.insert(sqlite3_column_int(stmt, 0), plan.size());
+            parent = nodeIndexes.value(sqlite3_column_int(stmt, 1), -1);
+        }
+
+        plan.append(QsStatement::PlanNode {
+                        parent,
+                        QByteArray(reinterpret_cast<const char*>
+                                   (sqlite3_column_text(stmt, 3)),
+                                   sqlite3_column_bytes(stmt, 3))});
+    }
+
+    sqlite3_finalize(stmt);
+    return plan;
+}
+
+bool qs::readTables(sqlite3* const           db,
+                    const char* const        query,
+                    QsStatement::TableNames& tables)
+{
+    tables.clear();
+
+    // compile program of query (views and triggers are expanded in it)
+    const QByteArray explainQuery = QByteArray("explain ") + query;
+    sqlite3_stmt* stmt = NULL;
+    if (qs::blockingPrepare(db, explainQuery.constData(),
+                            explainQuery.length(), 0, &stmt) != SQLITE_OK
+            || !stmt) {
+        return false;
+    }
+
+    // take opened b-trees (root page and database index) of tables and
+    // indexes (so table is found, even if no column is read from it, e.g. in
+    // 'count(*)'); columns are (addr, opcode, p1, p2, p3, ...); tables are
+    // not known completely for virtual table (VOpen, VFilter) and schema
+    // table (root page 1), whose rows are not in b-tree of named table
+    QVector<std::pair<int, int> > trees;
+    bool complete = true;
+    int code;
+    while (complete && (code = qs::blockingStep(stmt)) == SQLITE_ROW) {
+        const char* opcode =
+                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        if (!opcode) {
+            continue;
+        } else if (std::strcmp(opcode, "VOpen") == 0
+                   || std::strcmp(opcode, "VFilter") == 0) {
+            complete = false;
+        } else if (std::strcmp(opcode, "OpenRead") == 0
+                   || std::strcmp(opcode, "ReopenIdx") == 0) {
+            const std::pair<int, int> tree {sqlite3_column_int(stmt, 4),
+                                            sqlite3_column_int(stmt, 3)};
+            if (tree.second == 1) {
+                complete = false;
+            } else if (!trees.contains(tree)) {
+                trees.append(tree);
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (!complete || code != SQLITE_DONE) {
+        return false;
+    }
+
+    // find names of databases and tables of b-trees
+    QHash<int, QByteArray> databases;  // index -> name
+    if (!trees.isEmpty()) {
+        if (qs::blockingPrepare(db, "pragma database_list", -1, 0, &stmt)
+                != SQLITE_OK || !stmt) {
+            return false;
+        }
+        while (qs::blockingStep(stmt) == SQLITE_ROW) {
+            databases.insert(sqlite3_column_int(stmt, 0),
+                             QByteArray(reinterpret_cast<const char*>(
+                                            sqlite3_column_text(stmt, 1))));
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    for (const std::pair<int, int>& tree : trees) {
+        const QByteArray database = databases.value(tree.first);
+        const QByteArray tableQuery = "select tbl_name from \"" + database
+                + "\".sqlite_master where rootpage = ?";
+        if (database.isEmpty()
+                || qs::blockingPrepare(db, tableQuery.constData(),
+                                       tableQuery.length(), 0, &stmt)
+                   != SQLITE_OK || !stmt) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, tree.second);
+        if (qs::blockingStep(stmt) == SQLITE_ROW) {
+            const QByteArray table(reinterpret_cast<const char*>(
+                                       sqlite3_column_text(stmt, 0)));
+            bool known = false;
+            for (const QsStatement::TableName& name : tables) {
+                if (name.table == table && name.database == database) {
+                    known = true;
+                    break;
+                }
+            }
+            if (!known) {
+                tables.append(QsStatement::TableName {database, table});
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    return true;
+}
+
+QsError qs::processExecResult(
         const qs::ExecResult* resultPtr,
-        const qs::HandlerPtr& handlerPtr) Q_DECL_NOTHROW
+        const qs::Handler*    handlerPtr) Q_DECL_NOTHROW
 {
-    QByteArray resultStr;  // for result
+    QsError result;  // error, which is not handled
 
     // check if pointers to execution result and handlers are not null
     if (resultPtr) {
         if (handlerPtr) {
             try {
-                // check if error message is null,
+                // check if error is empty,
                 // otherwise check if error handler is not null (run it if true,
-                // otherwise save error message into result string)
+                // otherwise return error)
                 if (resultPtr->second.isEmpty()) {
                     // check if onSuccess is not empty (and run it, if true)
                     if (handlerPtr->first) {
@@ -21,41 +159,153 @@ QByteArray qs::processExexResult(
                 } else if (handlerPtr->second) {
                     handlerPtr->second(resultPtr->second);
                 } else {
-                    resultStr = resultPtr->second;
+                    result = resultPtr->second;
                 }
             } catch (const std::exception& exception) {
                 // try put exception message into result
                 try {
-                    resultStr = exception.what();
+                    result = QsError(QsError::ExceptionError,
+                                     QByteArray(exception.what()));
                 } catch (...) {
-                    resultStr = badAllocErrMsg;
+                    result = QsError(QsError::ExceptionError, badAllocErrMsg);
                 }
             } catch (...) {
-                resultStr = unknownExceptionErrMsg;
+                result = QsError(QsError::ExceptionError,
+                                 unknownExceptionErrMsg);
             }
         } else {
-            resultStr = QByteArrayLiteral("Error: result handlers not exists.");
+            result = QsError(QsError::TaskError,
+                             "Error: result handlers not exists.");
         }
     } else {
-        resultStr = QByteArrayLiteral("Error: execution result not exist.");
+        result = QsError(QsError::TaskError,
+                         "Error: execution result not exist.");
     }
 
-    return resultStr;
+    return result;
 }
 
+#ifdef SQLITE_ENABLE_UNLOCK_NOTIFY
+
+namespace {
 
+struct UnlockNotification
+{
+    bool           fired {false};
+    QMutex         mutex;
+    QWaitCondition condition;
+};
 
-QByteArray qs::buildConnErrMsg(const char*         message,
-                               const QsConnection& connection)
+void unlockNotify(void** args, const int count) noexcept
 {
-    QByteArray result(message);
-    const QByteArray& error = connection.lastError();
+    for (int i = 0; i < count; ++i) {
+        UnlockNotification* notification =
+                static_cast<UnlockNotification*>(args[i]);
 
-    // if error is not empty, append it to error message
-    if (!error.isEmpty()) {
-        result.append(" (").append(error).append(')');
+        QMutexLocker locker(&notification->mutex);
+        notification->fired = true;
+        notification->condition.wakeOne();
     }
-    result.append('.');
+}
 
-    return result;
+// wait until connection, which blocks db, finishes its transaction
+// (callback may be invoked immediately, from sqlite3_unlock_notify() itself)
+int waitForUnlock(sqlite3* db) noexcept
+{
+    UnlockNotification notification;
+
+    const int resultCode = sqlite3_unlock_notify(db, unlockNotify,
+                                                 &notification);
+    if (resultCode == SQLITE_OK) {
+        QMutexLocker locker(&notification.mutex);
+        while (!notification.fired) {
+            notification.condition.wait(&notification.mutex);
+        }
+    }
+
+    return resultCode;
+}
+
+bool isSharedCacheLock(sqlite3* db, const int resultCode) noexcept
+{
+    return (resultCode & 0xFF) == SQLITE_LOCKED
+            && sqlite3_extended_errcode(db) == SQLITE_LOCKED_SHAREDCACHE;
+}
+
+}
+
+int qs::blockingStep(sqlite3_stmt* stmt) Q_DECL_NOTHROW
+{
+    sqlite3* db = sqlite3_db_handle(stmt);
+
+    int resultCode;
+    while (isSharedCacheLock(db, resultCode = sqlite3_step(stmt))) {
+        if (waitForUnlock(db) != SQLITE_OK) {
+            break;
+        }
+        sqlite3_reset(stmt);
+    }
+
+    return resultCode;
+}
+
+int qs::blockingPrepare(sqlite3*           db,
+                        const char*        query,
+                        const int          bytes,
+                        const unsigned int flags,
+                        sqlite3_stmt**     stmt) Q_DECL_NOTHROW
+{
+    int resultCode;
+    while (isSharedCacheLock(db, resultCode = sqlite3_prepare_v3(
+                                 db, query, bytes, flags, stmt, NULL))) {
+        if (waitForUnlock(db) != SQLITE_OK) {
+            break;
+        }
+    }
+
+    return resultCode;
+}
+
+int qs::blockingPrepare16(sqlite3*       db,
+                          const void*    query,
+                          const int      bytes,
+                          sqlite3_stmt** stmt,
+                          const void**   tail) Q_DECL_NOTHROW
+{
+    int resultCode;
+    while (isSharedCacheLock(db, resultCode = sqlite3_prepare16_v2(
+                                 db, query, bytes, stmt, tail))) {
+        if (waitForUnlock(db) != SQLITE_OK) {
+            break;
+        }
+    }
+
+    return resultCode;
+}
+
+#else
+
+int qs::blockingStep(sqlite3_stmt* stmt) Q_DECL_NOTHROW
+{
+    return sqlite3_step(stmt);
+}
+
+int qs::blockingPrepare(sqlite3*           db,
+                        const char*        query,
+                        const int          bytes,
+                        const unsigned int flags,
+                        sqlite3_stmt**     stmt) Q_DECL_NOTHROW
+{
+    return sqlite3_prepare_v3(db, query, bytes, flags, stmt, NULL);
 }
+
+int qs::blockingPrepare16(sqlite3*       db,
+                          const void*    query,
+                          const int      bytes,
+                          sqlite3_stmt** stmt,
+                          const void**   tail) Q_DECL_NOTHROW
+{
+    return sqlite3_prepare16_v2(db, query, bytes, stmt, tail);
+}
+
+#endif
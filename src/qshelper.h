@@ -1,23 +1,150 @@
 #ifndef QS_HELPER_H
 #define QS_HELPER_H
 
-#include <functional>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include <QByteArray>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QVariant>
 
 #include "../include/qsconnection.h"
+#include "../include/qsconnectionworker.h"
+#include "../include/qsstatement.h"
+#include "../include/sqlite3.h"
 
 
 namespace qs {
 
-using ExecResult = std::pair<QVariant,QByteArray>;
-using OnSuccess  = std::function<void (QVariant   result)>;
-using OnError    = std::function<void (QByteArray errorMessage)>;
-using Handler    = std::pair<OnSuccess, OnError>;
-using HandlerPtr = std::shared_ptr<Handler>;
+using ExecResult   = QsConnectionWorker::ExecResult;
+using OnSuccess    = QsConnectionWorker::OnSuccess;
+using OnError      = QsConnectionWorker::OnError;
+using Handler      = QsConnectionWorker::Handler;
+using HandlerPtr   = QsConnectionWorker::HandlerPtr;
+using Task         = QsConnectionWorker::Task;
+using StmtTask     = QsConnectionWorker::StmtTask;
+using PreparedTask = QsConnectionWorker::PreparedTask;
+
+// handler of job: owned by job or shared with caller (given by HandlerPtr)
+struct JobHandler
+{
+    Handler    handler;
+    HandlerPtr handlerPtr;
+    bool       isShared {false};
+
+    inline const Handler* get() const noexcept
+    {
+        return isShared ? handlerPtr.get() : &handler;
+    }
+};
+
+// task, which is moved from QsConnectionAsyncWorker into worker thread
+// (only task of given kind is set)
+struct Job
+{
+    enum Kind {
+        RunTask = 0,
+        RunStmtTask,
+        RunPreparedTask,
+        RunCachedTask    // prepared task with parameters (see execCached)
+    };
+
+    // how result is delivered: by signal with data, or to handler,
+    // which is run in worker thread or in thread of async worker object
+    enum Delivery {
+        DeliverData = 0,
+        HandleInWorkerThread,
+        HandleInObjectThread
+    };
+
+    Kind         kind            {RunTask};
+    Delivery     delivery        {DeliverData};
+    Task         task;
+    StmtTask     stmtTask;
+    PreparedTask preparedTask;
+    QByteArray   query;
+    int          statementHandle {-1};
+    QVariantList params;
+    bool         inTransaction   {true};
+    JobHandler   handler;
+    QVariant     data;
+};
+
+struct JobResult
+{
+    ExecResult result;
+    JobHandler handler;
+};
+
+// items passed between threads in batches: producer wakes consumer up only
+// for first item of batch, consumer takes whole batch at once (vectors
+// are swapped, so their capacity is reused without allocations)
+template<typename T>
+class Batch
+{
+
+public:
+
+    // return true, if consumer must be woken up
+    bool push(T&& item)
+    {
+        QMutexLocker locker {&_mutex};
+        _items.push_back(std::move(item));
+
+        const bool wakeUp = !_wakeUpPending;
+        _wakeUpPending = true;
+
+        return wakeUp;
+    }
+
+    // process all queued items by given function (called in consumer thread
+    // only); nested call (e.g. from nested event loop) is done by outer one
+    template<typename F>
+    void consume(F&& process) noexcept
+    {
+        if (_consuming) {
+            _missedWakeUp = true;
+            return;
+        }
+
+        _consuming = true;
+        do {
+            _missedWakeUp = false;
+
+            // take batch (items, queued later, wake consumer up again)
+            {
+                QMutexLocker locker {&_mutex};
+                _items.swap(_taken);
+                _wakeUpPending = false;
+            }
+
+            for (T& item : _taken) {
+                process(item);
+            }
+            _taken.clear();
+        } while (_missedWakeUp);
+        _consuming = false;
+    }
+
+private:
+
+    QMutex         _mutex;
+    std::vector<T> _items;
+    std::vector<T> _taken;
+    bool           _wakeUpPending {false};
+    bool           _consuming     {false};
+    bool           _missedWakeUp  {false};
+
+};
+
+// queues between QsConnectionAsyncWorker and its QsConnectionWorker
+struct JobQueue
+{
+    Batch<Job>       jobs;
+    Batch<JobResult> results;
+};
 
 const QByteArray badAllocErrMsg =
         QByteArrayLiteral("Bad allocation exception!");
@@ -25,11 +152,39 @@ const QByteArray badAllocErrMsg =
 const QByteArray unknownExceptionErrMsg =
         QByteArrayLiteral("Unknown exception!");
 
-QByteArray processExexResult(const ExecResult* resultPtr,
-                             const HandlerPtr& handlerPtr) Q_DECL_NOTHROW;
+// run handler of result and return error, which is not handled
+// (error of result without error handler or exception of handler)
+QsError processExecResult(const ExecResult* resultPtr,
+                          const Handler*    handlerPtr) Q_DECL_NOTHROW;
+
+// sqlite3_step() and sqlite3_prepare_v3(), which wait (without spinning) for
+// release of table lock, held by other connection to the same shared cache
+// (wait is done by sqlite3_unlock_notify(), if library supports it;
+// SQLITE_LOCKED is returned, if wait would cause deadlock)
+int blockingStep(sqlite3_stmt* stmt) Q_DECL_NOTHROW;
+
+int blockingPrepare(sqlite3*       db,
+                    const char*    query,
+                    int            bytes,
+                    unsigned int   flags,
+                    sqlite3_stmt** stmt) Q_DECL_NOTHROW;
+
+// run EXPLAIN QUERY PLAN for query (nodes of old sqlite versions, which
+// does not give tree, are top level nodes)
+QsStatement::QueryPlan readQueryPlan(sqlite3* db, const char* query);
+
+// collect tables, whose b-trees are opened by program of query (see
+// EXPLAIN); return false, if query or schema can not be read, or if query
+// reads virtual table or schema table (so its tables are not known)
+bool readTables(sqlite3*                 db,
+                const char*              query,
+                QsStatement::TableNames& tables);
 
-QByteArray buildConnErrMsg(const char*         message,
-                           const QsConnection& connection);
+int blockingPrepare16(sqlite3*       db,
+                      const void*    query,
+                      int            bytes,
+                      sqlite3_stmt** stmt,
+                      const void**   tail = NULL) Q_DECL_NOTHROW;
 
 }
 
@@ -0,0 +1,477 @@
+#include "../include/qsparallelreader.h"
+
+#include <algorithm>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "../include/qserror.h"
+#include "../include/qsstatement.h"
+#include "../include/sqlite3.h"
+#include "qshelper.h"
+
+using OperationResult = std::pair<bool, QByteArray>;
+
+
+namespace {
+
+// readers wait for each other in slices, so stop of scan is noticed
+const unsigned long waitSlice = 50;
+
+const QByteArray cancelledScanErr =
+        QByteArrayLiteral("Error: parallel scan is cancelled.");
+
+const char* const beginErr = "Error on begin transaction";
+
+// default merge of partial results
+void appendPartial(QVariantList& result, QVariant&& partial)
+{
+    if (partial.userType() == QMetaType::QVariantList) {
+        result.append(partial.toList());
+    } else {
+        result.append(std::move(partial));
+    }
+}
+
+}
+
+
+// state of one scan, shared by jobs of readers
+struct QsParallelReader::Scan
+{
+    RangeTask  task;
+    Combine    combine;
+    OnSuccess  onSuccess;
+    OnError    onError;
+    QByteArray boundsQuery;
+    qint64     first {0};
+    qint64     last  {-1};
+    int        readerCount {0};
+
+    // scan is cancelled by stop() of reader or by failed submit
+    std::shared_ptr<QAtomicInt> stopCount;
+    int                         startStopCount {0};
+    QAtomicInt                  cancelled;
+
+    // ranges and snapshot are published by first reader
+    QMutex                 mutex;
+    QWaitCondition         changed;
+    bool                   published     {false};
+    int                    openedReaders {0};
+    QVector<Range>         ranges;
+    QsConnection::Snapshot snapshot;
+
+    // errors are saved by reader threads (one item for each reader),
+    // partial results are gathered in object thread
+    std::vector<QsError>  errors;
+    std::vector<QVariant> partials;
+    int                   pendingReaders {0};
+    bool                  reported       {false};
+
+    inline bool isCancelled() const noexcept
+    {
+        return cancelled.loadAcquire()
+                || stopCount->loadAcquire() != startStopCount;
+    }
+
+    // run in worker thread of first reader
+    QVariant readFirst(QsConnection& connection);
+
+    // run in worker thread of other reader
+    QVariant readPart(QsConnection& connection, int index);
+
+    // run in object thread for result of reader
+    void finish(int index, QVariant partial, QsError error);
+
+    bool readBounds(QsConnection& connection);
+
+    void publish() noexcept;
+
+    // end read transaction of first reader, when other readers of ranges
+    // have opened its snapshot
+    void releaseSnapshot() noexcept;
+};
+
+QVariant QsParallelReader::Scan::readFirst(QsConnection& connection)
+{
+    // begin read transaction (it is started by first read) and take
+    // its snapshot for other readers
+    if (isCancelled()) {
+        errors[0] = QsError(QsError::TaskError, cancelledScanErr);
+    } else if (!connection.transaction(QsConnection::Deferred)) {
+        errors[0] = QsError::fromConnection(beginErr, connection);
+    } else {
+        const bool isRead = boundsQuery.isEmpty()
+                ? connection.execute(QByteArrayLiteral("pragma schema_version"))
+                : readBounds(connection);
+        if (isRead) {
+            snapshot = connection.takeSnapshot();
+        } else {
+            if (errors[0].isEmpty()) {
+                errors[0] = QsError::fromConnection(
+                            "Error on read of scan bounds", connection);
+            }
+            connection.rollback();
+        }
+    }
+
+    publish();
+    if (!errors[0].isEmpty() || ranges.isEmpty()) {
+        // transaction of empty range is finished here
+        if (errors[0].isEmpty() && !connection.commit()) {
+            errors[0] = QsError::fromConnection("Error on commit",
+                                                connection);
+        }
+        return QVariant();
+    }
+
+    QVariant result;
+    try {
+        result = task(connection, ranges.first().first, ranges.first().last);
+    } catch (...) {
+        releaseSnapshot();
+        connection.rollback();
+        throw;
+    }
+
+    releaseSnapshot();
+    if (!connection.commit()) {
+        errors[0] = QsError::fromConnection("Error on commit", connection);
+    }
+
+    return result;
+}
+
+QVariant QsParallelReader::Scan::readPart(QsConnection& connection,
+                                          const int     index)
+{
+    // wait for range and snapshot of first reader
+    Range range;
+    QsConnection::Snapshot partSnapshot;
+    {
+        QMutexLocker locker {&mutex};
+        while (!published && !isCancelled()) {
+            changed.wait(&mutex, waitSlice);
+        }
+
+        if (!published) {
+            errors[index] = QsError(QsError::TaskError, cancelledScanErr);
+            return QVariant();
+        }
+
+        // reader is not needed for short range (or failed scan)
+        if (index >= ranges.size()) {
+            return QVariant();
+        }
+
+        range = ranges.at(index);
+        partSnapshot = snapshot;
+    }
+
+    // open snapshot and tell first reader, that it can be released
+    const bool began = connection.transaction(QsConnection::Deferred);
+    const int resultCode = (began && partSnapshot)
+            ? connection.openSnapshot(partSnapshot) : SQLITE_OK;
+    {
+        QMutexLocker locker {&mutex};
+        ++openedReaders;
+        changed.wakeAll();
+    }
+
+    if (!began) {
+        errors[index] = QsError::fromConnection(beginErr, connection);
+        return QVariant();
+    }
+
+    if (resultCode != SQLITE_OK) {
+        errors[index] = QsError(QsError::SqliteError,
+                                "Error on open of read snapshot",
+                                resultCode);
+        connection.rollback();
+        return QVariant();
+    }
+
+    QVariant result;
+    try {
+        result = task(connection, range.first, range.last);
+    } catch (...) {
+        connection.rollback();
+        throw;
+    }
+
+    if (!connection.commit()) {
+        errors[index] = QsError::fromConnection("Error on commit",
+                                                connection);
+    }
+
+    return result;
+}
+
+void QsParallelReader::Scan::finish(const int index,
+                                    QVariant  partial,
+                                    QsError   error)
+{
+    // error of task is saved as error of reader
+    if (!error.isEmpty()) {
+        errors[index] = std::move(error);
+    }
+    partials[index] = std::move(partial);
+
+    if (--pendingReaders > 0 || reported) {
+        return;
+    }
+    reported = true;
+
+    // report first error in order of readers
+    for (QsError& readerError : errors) {
+        if (!readerError.isEmpty()) {
+            if (onError) {
+                onError(std::move(readerError));
+            }
+            return;
+        }
+    }
+
+    // merge partial results in order of ranges
+    QVariant result;
+    const std::size_t rangeCount = static_cast<std::size_t>(ranges.size());
+    if (combine) {
+        for (std::size_t i = 0; i < rangeCount; ++i) {
+            result = (i == 0) ? std::move(partials[i])
+                              : combine(std::move(result),
+                                        std::move(partials[i]));
+        }
+    } else {
+        QVariantList list;
+        for (std::size_t i = 0; i < rangeCount; ++i) {
+            appendPartial(list, std::move(partials[i]));
+        }
+        result = std::move(list);
+    }
+
+    if (onSuccess) {
+        onSuccess(std::move(result));
+    }
+}
+
+bool QsParallelReader::Scan::readBounds(QsConnection& connection)
+{
+    QsStatement statement(connection, boundsQuery);
+    if (!statement.isValid()) {
+        return false;
+    }
+
+    // no row or NULL bound (e.g. min() of empty table) gives empty range
+    if (statement.next()) {
+        if (statement.columnCount() < 2) {
+            errors[0] = QsError(QsError::TaskError,
+                                "Error: bounds query must return 2 columns.");
+            return false;
+        }
+
+        if (!statement.isNull(0) && !statement.isNull(1)) {
+            first = statement.getInt64(0);
+            last = statement.getInt64(1);
+        }
+        return true;
+    }
+
+    return statement.lastErrorCode() == SQLITE_DONE;
+}
+
+void QsParallelReader::Scan::publish() noexcept
+{
+    QMutexLocker locker {&mutex};
+
+    if (errors[0].isEmpty()) {
+        try {
+            ranges = splitRange(first, last, readerCount);
+        } catch (...) {
+            errors[0] = QsError(QsError::ExceptionError,
+                                "Error: ranges of scan are not allocated.");
+        }
+    }
+
+    published = true;
+    changed.wakeAll();
+}
+
+void QsParallelReader::Scan::releaseSnapshot() noexcept
+{
+    // readers without snapshot do not depend on first reader
+    if (!snapshot) {
+        return;
+    }
+
+    QMutexLocker locker {&mutex};
+    while (openedReaders < ranges.size() - 1 && !isCancelled()) {
+        changed.wait(&mutex, waitSlice);
+    }
+}
+
+QsParallelReader::QsParallelReader(const QsConnectionConfig& config,
+                                   const int                 readerCount)
+    : _stopCount {std::make_shared<QAtomicInt>(0)}
+{
+    const int count = (readerCount > 0)
+            ? readerCount
+            : std::max(1, QThread::idealThreadCount());
+
+    _readers.reserve(static_cast<std::size_t>(count));
+    for (int i = 0; i < count; ++i) {
+        _readers.push_back(std::make_unique<QsConnectionAsyncWorker>(config));
+    }
+}
+
+QsParallelReader::~QsParallelReader() noexcept
+{
+    // cancel scans, so first reader does not wait for stopped readers
+    _stopCount->fetchAndAddOrdered(1);
+}
+
+OperationResult QsParallelReader::execute(RangeTask    task,
+                                          const qint64 first,
+                                          const qint64 last,
+                                          OnSuccess    onSuccess,
+                                          OnError      onError,
+                                          Combine      combine) Q_DECL_NOTHROW
+{
+    try {
+        std::shared_ptr<Scan> scan = std::make_shared<Scan>();
+        scan->task = std::move(task);
+        scan->first = first;
+        scan->last = last;
+        scan->onSuccess = std::move(onSuccess);
+        scan->onError = std::move(onError);
+        scan->combine = std::move(combine);
+
+        return start(scan);
+    } catch (...) {
+        return OperationResult(false, qs::badAllocErrMsg);
+    }
+}
+
+OperationResult QsParallelReader::execute(RangeTask  task,
+                                          QByteArray boundsQuery,
+                                          OnSuccess  onSuccess,
+                                          OnError    onError,
+                                          Combine    combine) Q_DECL_NOTHROW
+{
+    try {
+        std::shared_ptr<Scan> scan = std::make_shared<Scan>();
+        scan->task = std::move(task);
+        scan->boundsQuery = std::move(boundsQuery);
+        scan->onSuccess = std::move(onSuccess);
+        scan->onError = std::move(onError);
+        scan->combine = std::move(combine);
+
+        return start(scan);
+    } catch (...) {
+        return OperationResult(false, qs::badAllocErrMsg);
+    }
+}
+
+QVector<QsParallelReader::Range>
+QsParallelReader::splitRange(const qint64 first,
+                             const qint64 last,
+                             const int    count)
+{
+    QVector<Range> result;
+    if (first > last || count < 1) {
+        return result;
+    }
+
+    // width is count of keys minus 1 (so whole qint64 range does not
+    // overflow); first 'longParts' parts have one key more than others
+    const quint64 width = quint64(last) - quint64(first);
+    const quint64 parts = (width >= quint64(count) - 1) ? quint64(count)
+                                                        : width + 1;
+    quint64 partKeys = width / parts;
+    quint64 longParts = width % parts + 1;
+    if (longParts == parts) {
+        ++partKeys;
+        longParts = 0;
+    }
+
+    result.reserve(static_cast<int>(parts));
+    quint64 offset = quint64(first);
+    for (quint64 i = 0; i < parts; ++i) {
+        const quint64 partWidth = (i < longParts) ? partKeys : partKeys - 1;
+        result.append(Range {qint64(offset), qint64(offset + partWidth)});
+        offset += partWidth + 1;
+    }
+
+    return result;
+}
+
+OperationResult
+QsParallelReader::stop(const unsigned long waitMilliseconds) Q_DECL_NOTHROW
+{
+    _stopCount->fetchAndAddOrdered(1);
+
+    OperationResult result(true, QByteArray());
+    for (const std::unique_ptr<QsConnectionAsyncWorker>& reader : _readers) {
+        OperationResult readerResult = reader->stop(waitMilliseconds);
+        if (!readerResult.first && result.first) {
+            result = std::move(readerResult);
+        }
+    }
+
+    return result;
+}
+
+OperationResult
+QsParallelReader::start(const std::shared_ptr<Scan>& scan) Q_DECL_NOTHROW
+{
+    try {
+        const std::size_t count = _readers.size();
+        scan->readerCount = static_cast<int>(count);
+        scan->stopCount = _stopCount;
+        scan->startStopCount = _stopCount->loadAcquire();
+        scan->errors.resize(count);
+        scan->partials.resize(count);
+
+        // jobs of all readers are queued at once, so jobs of scans are
+        // in same order in each reader (and readers of one scan do not
+        // wait for readers, which are busy with later scan)
+        for (std::size_t i = 0; i < count; ++i) {
+            const int index = static_cast<int>(i);
+            QsConnectionAsyncWorker::Task task;
+            if (index == 0) {
+                task = [scan] (QsConnection& connection) {
+                    return scan->readFirst(connection);
+                };
+            } else {
+                task = [scan, index] (QsConnection& connection) {
+                    return scan->readPart(connection, index);
+                };
+            }
+
+            OperationResult result = _readers[i]->execute(
+                std::move(task),
+                [scan, index] (QVariant partial) {
+                    scan->finish(index, std::move(partial), QsError());
+                },
+                [scan, index] (QsError error) {
+                    scan->finish(index, QVariant(), std::move(error));
+                });
+
+            // queued jobs of scan are cancelled without handlers
+            if (!result.first) {
+                scan->cancelled.storeRelease(1);
+                scan->reported = true;
+                return result;
+            }
+
+            ++scan->pendingReaders;
+        }
+    } catch (...) {
+        scan->cancelled.storeRelease(1);
+        scan->reported = true;
+        return OperationResult(false, qs::badAllocErrMsg);
+    }
+
+    return OperationResult(true, QByteArray());
+}
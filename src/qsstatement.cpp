@@ -1,11 +1,16 @@
 #include "../include/qsstatement.h"
 
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
+#include <QHash>
 #include <QtGlobal>
 
 #include "sqlite3.h"
 #include "../include/qsconnection.h"
+#include "qshelper.h"
+#include "qsutf8.h"
 
 using BlobData      = QPair<unsigned char*, int>;
 using ConstBlobData = QPair<const unsigned char*, int>;
@@ -16,37 +21,185 @@ using ConstCStrData = QPair<const char*, int>;
 using CStr16Data      = QPair<QChar*, int>;
 using ConstCStr16Data = QPair<const QChar*, int>;
 
+namespace {
+
+// double size of open addressing table of interner
+template<typename Slots>
+void growTable(Slots& hashTable)
+{
+    Slots grown(std::max(16, hashTable.size() * 2),
+                typename Slots::value_type {0, -1});
+    const uint mask = uint(grown.size() - 1);
+    const Slots& oldTable = hashTable;
+    for (const auto& slot : oldTable) {
+        if (slot.index >= 0) {
+            uint i = slot.hash & mask;
+            while (grown[int(i)].index >= 0) {
+                i = (i + 1) & mask;
+            }
+            grown[int(i)] = slot;
+        }
+    }
+
+    hashTable.swap(grown);
+}
+
+// return value of interner for raw bytes of column; new value is created
+// by 'create' and kept, only if 'equals' accepts it (so value of invalid
+// UTF-8, which is never equal to its raw bytes, is not kept)
+template<typename T, typename Slots, typename Equals, typename Create>
+T internValue(Slots&            hashTable,
+              QVector<T>&       values,
+              const void* const data,
+              const int         bytes,
+              Equals            equals,
+              Create            create)
+{
+    // keep load factor of table below 1/2
+    if ((values.size() + 1) * 2 > hashTable.size()) {
+        growTable(hashTable);
+    }
+
+    const uint hash = qHashBits(data, size_t(bytes));
+    const uint mask = uint(hashTable.size() - 1);
+    for (uint i = hash & mask; ; i = (i + 1) & mask) {
+        auto& slot = hashTable[int(i)];
+        if (slot.index < 0) {
+            T value = create();
+            if (equals(value)) {
+                slot.hash = hash;
+                slot.index = values.size();
+                values.append(value);
+            }
+            return value;
+        }
+
+        if (slot.hash == hash && equals(values.at(slot.index))) {
+            return values.at(slot.index);
+        }
+    }
+}
+
+// compare UTF-8 text with string without decoding it (invalid UTF-8 is
+// never equal)
+bool equalsUtf8(const QString& value,
+                const char*    data,
+                const int      bytes) noexcept
+{
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* const inEnd = in + bytes;
+    const ushort* out = value.utf16();
+    const ushort* const outEnd = out + value.size();
+
+    while (in != inEnd) {
+        uint code = *in++;
+        if (code >= 0x80) {
+            // decode multibyte sequence (overlong forms and surrogates
+            // are invalid)
+            int extra;
+            uint minCode;
+            if (code >= 0xc2 && code <= 0xdf) {
+                extra = 1;
+                minCode = 0x80;
+                code &= 0x1f;
+            } else if ((code & 0xf0) == 0xe0) {
+                extra = 2;
+                minCode = 0x800;
+                code &= 0x0f;
+            } else if (code >= 0xf0 && code <= 0xf4) {
+                extra = 3;
+                minCode = 0x10000;
+                code &= 0x07;
+            } else {
+                return false;
+            }
+
+            if (inEnd - in < extra) {
+                return false;
+            }
+            for (; extra > 0; --extra) {
+                const uint byte = *in++;
+                if ((byte & 0xc0) != 0x80) {
+                    return false;
+                }
+                code = (code << 6) | (byte & 0x3f);
+            }
+            if (code < minCode || code > 0x10ffff
+                    || (code >= 0xd800 && code <= 0xdfff)) {
+                return false;
+            }
+        }
+
+        // compare code point with one or two (surrogate pair) UTF-16 units
+        if (code < 0x10000) {
+            if (out == outEnd || *out != code) {
+                return false;
+            }
+            ++out;
+        } else {
+            if (outEnd - out < 2
+                    || out[0] != 0xd800 + ((code - 0x10000) >> 10)
+                    || out[1] != 0xdc00 + (code & 0x3ff)) {
+                return false;
+            }
+            out += 2;
+        }
+    }
+
+    return out == outEnd;
+}
+
+}
+
+
+void QsStatement::Interner::clear() noexcept
+{
+    _byteArraySlots.clear();
+    _byteArrays.clear();
+    _stringSlots.clear();
+    _strings.clear();
+}
 
 QsStatement::QsStatement() noexcept
     : _statement {NULL},
-      _db {NULL}
+      _db {NULL},
+      _utf16 {false}
 {}
 
 QsStatement::QsStatement(const QsConnection& connection,
                          const QByteArray&   query) noexcept
     : _statement {NULL},
-      _db {connection._db}
+      _db {connection._db},
+      _utf16 {connection.encoding() == QsConnection::Utf16}
 {
     // try compile statement and check result
     if (!compile(query)) {
         _db = NULL;
+    } else {
+        connection.checkPlan(_statement);
     }
 }
 
 QsStatement::QsStatement(const QsConnection& connection,
                          const QString&      query) noexcept
     : _statement {NULL},
-      _db {connection._db}
+      _db {connection._db},
+      _utf16 {connection.encoding() == QsConnection::Utf16}
 {
     // try compile statement and check result
     if (!compile(query)) {
         _db = NULL;
+    } else {
+        connection.checkPlan(_statement);
     }
 }
 
 QsStatement::QsStatement(QsStatement&& statement) noexcept
     : _statement {statement._statement},
-      _db {statement._db}
+      _db {statement._db},
+      _utf16 {statement._utf16},
+      _sharedBytes {std::move(statement._sharedBytes)},
+      _sharedStrings {std::move(statement._sharedStrings)}
 {
     statement.reset();
 }
@@ -56,6 +209,50 @@ QsStatement::~QsStatement()
     clear();
 }
 
+int QsStatement::appendString(const int index, QString& buffer) const
+{
+    Q_ASSERT_X(_statement != NULL, "appendString", "Statement is invalid");
+    Q_ASSERT_X(index >= 0 && index < sqlite3_column_count(_statement),
+               "appendString", "index out of range");
+
+    // UTF-16 text is copied as is; UTF-8 text needs at most one QChar
+    // per byte, so it is decoded directly into buffer
+    const void* text;
+    int units;
+    if (_utf16) {
+        text = sqlite3_column_text16(_statement, index);
+        units = sqlite3_column_bytes16(_statement, index) / 2;
+    } else {
+        text = sqlite3_column_text(_statement, index);
+        units = sqlite3_column_bytes(_statement, index);
+    }
+    if (!text || units == 0) {
+        return 0;
+    }
+
+    const int used = buffer.size();
+    buffer.resize(used + units);
+    QChar* out = buffer.data() + used;
+    if (_utf16) {
+        memcpy(out, text, units * sizeof(QChar));
+    } else {
+        const char* utf8 = static_cast<const char*>(text);
+        const int length = qs::decodeUtf8(utf8, units, out);
+        if (length >= 0) {
+            units = length;
+        } else {
+            // invalid UTF-8 is decoded by Qt (with replacement chars),
+            // which never gives more QChars than bytes
+            const QString decoded = QString::fromUtf8(utf8, units);
+            units = decoded.length();
+            memcpy(out, decoded.constData(), units * sizeof(QChar));
+        }
+        buffer.resize(used + units);
+    }
+
+    return units;
+}
+
 bool QsStatement::bindBlob(const int         index,
                            const void* const value,
                            const int         bytes) const noexcept
@@ -104,6 +301,18 @@ bool QsStatement::bindBlobCopy(const int         index,
                              value.length(), SQLITE_TRANSIENT) == SQLITE_OK;
 }
 
+bool QsStatement::bindBlobShared(const int index, QByteArray value) const
+{
+    Q_ASSERT_X(_statement != NULL, "bindBlobShared", "Statement is invalid");
+    Q_ASSERT_X(index > 0 && index <= sqlite3_bind_parameter_count(_statement),
+               "bindBlobShared", "index out of range");
+
+    const int bytes = value.length();
+    return sqlite3_bind_blob(_statement, index,
+                             keepShared(index, std::move(value)),
+                             bytes, SQLITE_STATIC) == SQLITE_OK;
+}
+
 bool QsStatement::bindBool(const int  index,
                            const bool value) const noexcept
 {
@@ -221,6 +430,18 @@ bool QsStatement::bindText16Copy(const int      index,
             == SQLITE_OK;
 }
 
+bool QsStatement::bindText16Shared(const int index, QString value) const
+{
+    Q_ASSERT_X(_statement != NULL, "bindText16Shared", "Statement is invalid");
+    Q_ASSERT_X(index > 0 && index <= sqlite3_bind_parameter_count(_statement),
+               "bindText16Shared", "index out of range");
+
+    const int bytes = value.length() << 1;
+    return sqlite3_bind_text16(_statement, index,
+                               keepShared(index, std::move(value)),
+                               bytes, SQLITE_STATIC) == SQLITE_OK;
+}
+
 bool QsStatement::bindTextCopy(const int         index,
                                const char* const value,
                                const int         bytes) const noexcept
@@ -240,12 +461,31 @@ bool QsStatement::bindTextCopy(const int      index,
     Q_ASSERT_X(index > 0 && index <= sqlite3_bind_parameter_count(_statement),
                "bindTextCopy", "index out of range");
 
+    // UTF-16 text is stored as is in UTF-16 database
+    if (_utf16) {
+        return sqlite3_bind_text16(_statement, index, value.constData(),
+                                   value.length() << 1, SQLITE_TRANSIENT)
+                == SQLITE_OK;
+    }
+
     const QByteArray& textUtf8 = value.toUtf8();
 
     return sqlite3_bind_text(_statement, index, textUtf8.constData(),
                              textUtf8.length(), SQLITE_TRANSIENT) == SQLITE_OK;
 }
 
+bool QsStatement::bindTextShared(const int index, QByteArray value) const
+{
+    Q_ASSERT_X(_statement != NULL, "bindTextShared", "Statement is invalid");
+    Q_ASSERT_X(index > 0 && index <= sqlite3_bind_parameter_count(_statement),
+               "bindTextShared", "index out of range");
+
+    const int bytes = value.length();
+    return sqlite3_bind_text(_statement, index,
+                             keepShared(index, std::move(value)),
+                             bytes, SQLITE_STATIC) == SQLITE_OK;
+}
+
 unsigned QsStatement::byteLength(const int index) const noexcept
 {
     Q_ASSERT_X(_statement != NULL, "byteLength", "Statement is invalid");
@@ -277,6 +517,10 @@ void QsStatement::clearBindings() const noexcept
     Q_ASSERT_X(_statement != NULL, "clearBindings", "Statement is invalid");
 
     sqlite3_clear_bindings(_statement);
+
+    // release values of shared binds
+    _sharedBytes.clear();
+    _sharedStrings.clear();
 }
 
 int QsStatement::columnCount() const noexcept
@@ -310,7 +554,7 @@ bool QsStatement::execute() const noexcept
 {
     Q_ASSERT_X(_statement != NULL, "execute", "Statement is invalid");
 
-    if (sqlite3_step(_statement) == SQLITE_DONE) {
+    if (qs::blockingStep(_statement) == SQLITE_DONE) {
         sqlite3_reset(_statement);
         return true;
     }
@@ -394,6 +638,30 @@ QByteArray QsStatement::getByteArray(const int index) const
                       sqlite3_column_bytes(_statement, index));
 }
 
+QByteArray QsStatement::getByteArray(const int index,
+                                     Interner& interner) const
+{
+    Q_ASSERT_X(_statement != NULL, "getByteArray", "Statement is invalid");
+    Q_ASSERT_X(index >= 0 && index < sqlite3_column_count(_statement),
+               "getByteArray", "index out of range");
+
+    const char* data = reinterpret_cast<const char*>
+            (sqlite3_column_blob(_statement, index));
+    const int bytes = sqlite3_column_bytes(_statement, index);
+    if (!data || bytes == 0) {
+        return QByteArray(data, bytes);
+    }
+
+    return internValue(interner._byteArraySlots, interner._byteArrays,
+                       data, bytes,
+                       [data, bytes] (const QByteArray& value) {
+        return value.size() == bytes
+                && memcmp(value.constData(), data, size_t(bytes)) == 0;
+    }, [data, bytes] () {
+        return QByteArray(data, bytes);
+    });
+}
+
 ConstCStrData QsStatement::getCStr(const int index) const noexcept
 {
     Q_ASSERT_X(_statement != NULL, "getCStr", "Statement is invalid");
@@ -484,9 +752,58 @@ QString QsStatement::getString(const int index) const
     Q_ASSERT_X(index >= 0 && index < sqlite3_column_count(_statement),
                "getString", "index out of range");
 
-    return QString::fromUtf8(reinterpret_cast<const char*>
-                             (sqlite3_column_text(_statement, index)),
-                             sqlite3_column_bytes(_statement, index));
+    // UTF-16 database returns text as is
+    if (_utf16) {
+        return getString16(index);
+    }
+
+    return qs::stringFromUtf8(reinterpret_cast<const char*>
+                              (sqlite3_column_text(_statement, index)),
+                              sqlite3_column_bytes(_statement, index));
+}
+
+QString QsStatement::getString(const int index, Interner& interner) const
+{
+    Q_ASSERT_X(_statement != NULL, "getString", "Statement is invalid");
+    Q_ASSERT_X(index >= 0 && index < sqlite3_column_count(_statement),
+               "getString", "index out of range");
+
+    if (sqlite3_column_type(_statement, index) == SQLITE_NULL) {
+        return QString();
+    }
+
+    // value is found by raw bytes of column in database encoding
+    if (_utf16) {
+        const void* data = sqlite3_column_text16(_statement, index);
+        const int bytes = sqlite3_column_bytes16(_statement, index);
+        if (!data || bytes == 0) {
+            return getString16(index);
+        }
+
+        return internValue(interner._stringSlots, interner._strings,
+                           data, bytes,
+                           [data, bytes] (const QString& value) {
+            return value.size() * 2 == bytes
+                    && memcmp(value.utf16(), data, size_t(bytes)) == 0;
+        }, [data, bytes] () {
+            return QString(static_cast<const QChar*>(data), bytes / 2);
+        });
+    }
+
+    const char* data = reinterpret_cast<const char*>
+            (sqlite3_column_text(_statement, index));
+    const int bytes = sqlite3_column_bytes(_statement, index);
+    if (!data || bytes == 0) {
+        return qs::stringFromUtf8(data, bytes);
+    }
+
+    return internValue(interner._stringSlots, interner._strings,
+                       data, bytes,
+                       [data, bytes] (const QString& value) {
+        return equalsUtf8(value, data, bytes);
+    }, [data, bytes] () {
+        return qs::stringFromUtf8(data, bytes);
+    });
 }
 
 QString QsStatement::getString16(const int index) const
@@ -497,7 +814,7 @@ QString QsStatement::getString16(const int index) const
 
     return QString(reinterpret_cast<const QChar*>
                    (sqlite3_column_text16(_statement, index)),
-                   sqlite3_column_bytes16(_statement, index));
+                   sqlite3_column_bytes16(_statement, index) / 2);
 }
 
 bool QsStatement::isNull(const int index) const noexcept
@@ -541,7 +858,14 @@ bool QsStatement::next() const noexcept
 {
     Q_ASSERT_X(_statement != NULL, "next", "Statement is invalid");
 
-    return sqlite3_step(_statement) == SQLITE_ROW;
+    return qs::blockingStep(_statement) == SQLITE_ROW;
+}
+
+bool QsStatement::readTables(TableNames& tables) const
+{
+    Q_ASSERT_X(_statement != NULL, "readTables", "Statement is invalid");
+
+    return qs::readTables(_db, sqlite3_sql(_statement), tables);
 }
 
 bool QsStatement::recompile(const QByteArray& query) noexcept
@@ -561,6 +885,13 @@ QByteArray QsStatement::query() const
     return QByteArray(sqlite3_sql(_statement));
 }
 
+QsStatement::QueryPlan QsStatement::queryPlan() const
+{
+    Q_ASSERT_X(_statement != NULL, "queryPlan", "Statement is invalid");
+
+    return qs::readQueryPlan(_db, sqlite3_sql(_statement));
+}
+
 QString QsStatement::query16() const
 {
     Q_ASSERT_X(_statement != NULL, "query16", "Statement is invalid");
@@ -568,6 +899,13 @@ QString QsStatement::query16() const
     return QString::fromUtf8(sqlite3_sql(_statement));
 }
 
+void QsStatement::rewind() const noexcept
+{
+    Q_ASSERT_X(_statement != NULL, "rewind", "Statement is invalid");
+
+    sqlite3_reset(_statement);
+}
+
 QsStatement::Type QsStatement::type() const noexcept
 {
     if (_statement) {
@@ -587,6 +925,9 @@ QsStatement& QsStatement::operator=(QsStatement&& statement) noexcept
         // move data from statement to this
         _statement = statement._statement;
         _db = statement._db;
+        _utf16 = statement._utf16;
+        _sharedBytes = std::move(statement._sharedBytes);
+        _sharedStrings = std::move(statement._sharedStrings);
 
         // reset statement
         statement.reset();
@@ -596,13 +937,43 @@ QsStatement& QsStatement::operator=(QsStatement&& statement) noexcept
 
 bool QsStatement::compile(const QByteArray& query) noexcept
 {
-    return _db && sqlite3_prepare_v2(_db, query.constData(), query.length(),
-                                     &_statement, NULL) == SQLITE_OK;
+    return _db && qs::blockingPrepare(_db, query.constData(), query.length(),
+                                      0, &_statement) == SQLITE_OK;
 }
 
 bool QsStatement::compile(const QString& query) noexcept
 {
-    return _db && sqlite3_prepare16_v2(_db, query.constData(),
-                                       query.length() << 1,
-                                       &_statement, NULL) == SQLITE_OK;
+    return _db && qs::blockingPrepare16(_db, query.constData(),
+                                        query.length() << 1,
+                                        &_statement) == SQLITE_OK;
+}
+
+const char* QsStatement::keepShared(const int index, QByteArray&& value) const
+{
+    // previous value of parameter is released here (sqlite does not read
+    // static value, when parameter is bound again)
+    if (_sharedBytes.size() < index) {
+        _sharedBytes.resize(index);
+    }
+    if (_sharedStrings.size() >= index) {
+        _sharedStrings[index - 1] = QString();
+    }
+
+    QByteArray& shared = _sharedBytes[index - 1];
+    shared = std::move(value);
+    return shared.constData();
+}
+
+const QChar* QsStatement::keepShared(const int index, QString&& value) const
+{
+    if (_sharedStrings.size() < index) {
+        _sharedStrings.resize(index);
+    }
+    if (_sharedBytes.size() >= index) {
+        _sharedBytes[index - 1] = QByteArray();
+    }
+
+    QString& shared = _sharedStrings[index - 1];
+    shared = std::move(value);
+    return shared.constData();
 }
@@ -0,0 +1,212 @@
+#include "qsutf8.h"
+
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QS_UTF8_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled with target attribute and called only if CPU
+// supports it, so library does not require -mavx2
+#if defined(QS_UTF8_SSE2) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define QS_UTF8_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using Utf16Unit = unsigned short;
+
+// widen run of ASCII bytes into UTF-16 units; it stops before block,
+// which contains non-ASCII byte (or is shorter than vector)
+using WidenAscii = void (*)(const unsigned char*& in,
+                            const unsigned char*  end,
+                            Utf16Unit*&           out);
+
+// count of bytes, which are decoded by scalar code after vector loop
+// stops on non-ASCII byte (so text without long ASCII runs does not retry
+// vector load for each character)
+constexpr std::ptrdiff_t scalarBlockSize = 16;
+
+#ifdef QS_UTF8_SSE2
+
+void widenAsciiSse2(const unsigned char*& in,
+                    const unsigned char*  end,
+                    Utf16Unit*&           out) noexcept
+{
+    const __m128i zero = _mm_setzero_si128();
+    while (end - in >= 16) {
+        const __m128i chunk =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        if (_mm_movemask_epi8(chunk)) {
+            return;
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                         _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8),
+                         _mm_unpackhi_epi8(chunk, zero));
+        in += 16;
+        out += 16;
+    }
+}
+
+#endif
+
+#ifdef QS_UTF8_AVX2
+
+__attribute__((target("avx2")))
+void widenAsciiAvx2(const unsigned char*& in,
+                    const unsigned char*  end,
+                    Utf16Unit*&           out) noexcept
+{
+    while (end - in >= 32) {
+        const __m256i chunk =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+        if (_mm256_movemask_epi8(chunk)) {
+            break;
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                            _mm256_cvtepu8_epi16(
+                                _mm256_castsi256_si128(chunk)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16),
+                            _mm256_cvtepu8_epi16(
+                                _mm256_extracti128_si256(chunk, 1)));
+        in += 32;
+        out += 32;
+    }
+
+    // tail (or ASCII half of last chunk) is widened by SSE2
+    widenAsciiSse2(in, end, out);
+}
+
+#endif
+
+WidenAscii selectWidenAscii() noexcept
+{
+#ifdef QS_UTF8_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &widenAsciiAvx2;
+    }
+#endif
+
+#ifdef QS_UTF8_SSE2
+    return &widenAsciiSse2;
+#else
+    // ASCII bytes are widened by scalar loop of decodeUtf8
+    return [] (const unsigned char*&, const unsigned char*,
+               Utf16Unit*&) noexcept {};
+#endif
+}
+
+// decode multibyte sequence (first byte is not ASCII) and return pointer
+// after it, or NULL if sequence is invalid, overlong, truncated or encodes
+// surrogate (such text is decoded by Qt with replacement characters)
+inline const unsigned char* decodeSequence(const unsigned char* in,
+                                           const unsigned char* end,
+                                           Utf16Unit*&          out) noexcept
+{
+    const unsigned lead = *in;
+    unsigned codePoint;
+    unsigned minimum;
+    std::ptrdiff_t length;
+    if ((lead & 0xE0) == 0xC0) {
+        codePoint = lead & 0x1F;
+        minimum = 0x80;
+        length = 2;
+    } else if ((lead & 0xF0) == 0xE0) {
+        codePoint = lead & 0x0F;
+        minimum = 0x800;
+        length = 3;
+    } else if ((lead & 0xF8) == 0xF0) {
+        codePoint = lead & 0x07;
+        minimum = 0x10000;
+        length = 4;
+    } else {
+        return nullptr;
+    }
+
+    if (end - in < length) {
+        return nullptr;
+    }
+
+    for (std::ptrdiff_t i = 1; i < length; ++i) {
+        const unsigned next = in[i];
+        if ((next & 0xC0) != 0x80) {
+            return nullptr;
+        }
+        codePoint = (codePoint << 6) | (next & 0x3F);
+    }
+
+    if (codePoint < minimum || codePoint > 0x10FFFF
+            || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+        return nullptr;
+    }
+
+    // code point outside of BMP is written as surrogate pair
+    if (codePoint >= 0x10000) {
+        codePoint -= 0x10000;
+        *out++ = Utf16Unit(0xD800 + (codePoint >> 10));
+        *out++ = Utf16Unit(0xDC00 + (codePoint & 0x3FF));
+    } else {
+        *out++ = Utf16Unit(codePoint);
+    }
+
+    return in + length;
+}
+
+}
+
+int qs::decodeUtf8(const char* const data,
+                   const int         bytes,
+                   QChar* const      out) noexcept
+{
+    static const WidenAscii widenAscii = selectWidenAscii();
+
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* const end = in + bytes;
+
+    // QString::fromUtf8 skips byte order mark, so such text is left to it
+    if (bytes >= 3 && in[0] == 0xEF && in[1] == 0xBB && in[2] == 0xBF) {
+        return -1;
+    }
+
+    Utf16Unit* const begin = reinterpret_cast<Utf16Unit*>(out);
+    Utf16Unit* dst = begin;
+    while (in < end) {
+        widenAscii(in, end, dst);
+
+        const unsigned char* const blockEnd =
+                (end - in > scalarBlockSize) ? in + scalarBlockSize : end;
+        while (in < blockEnd) {
+            if (*in < 0x80) {
+                *dst++ = *in++;
+            } else if (!(in = decodeSequence(in, end, dst))) {
+                return -1;
+            }
+        }
+    }
+
+    return static_cast<int>(dst - begin);
+}
+
+QString qs::stringFromUtf8(const char* const data, const int bytes)
+{
+    if (!data || bytes <= 0) {
+        return QString::fromUtf8(data, bytes);
+    }
+
+    QString result(bytes, Qt::Uninitialized);
+    const int length = decodeUtf8(data, bytes, result.data());
+    if (length < 0) {
+        return QString::fromUtf8(data, bytes);
+    }
+
+    result.truncate(length);
+    return result;
+}
@@ -0,0 +1,22 @@
+#ifndef QS_UTF8_H
+#define QS_UTF8_H
+
+#include <QChar>
+#include <QString>
+
+
+namespace qs {
+
+// decode UTF-8 text into 'out', which must have room for 'bytes' QChars
+// (valid UTF-8 never gives more UTF-16 units than bytes); return count of
+// written QChars or -1, if text is not valid UTF-8 (so caller can use
+// QString::fromUtf8, which replaces invalid sequences);
+// ASCII runs are widened by SSE2 or AVX2 (selected once at runtime)
+int decodeUtf8(const char* data, int bytes, QChar* out) noexcept;
+
+// convert UTF-8 text into QString (same result as QString::fromUtf8)
+QString stringFromUtf8(const char* data, int bytes);
+
+}
+
+#endif
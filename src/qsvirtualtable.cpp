@@ -0,0 +1,392 @@
+#include "../include/qsvirtualtable.h"
+
+#include <cmath>
+#include <new>
+
+#include "sqlite3.h"
+
+namespace {
+
+// flags of constraints, used by virtual table index (idxNum)
+enum IndexFlag {
+    KeyEqual       = 0x01,
+    KeyGreater     = 0x02,
+    KeyGreaterOrEq = 0x04,
+    KeyLess        = 0x08,
+    KeyLessOrEq    = 0x10,
+    KeyOrdered     = 0x20,
+    IndexFlagsMask = 0x3F,
+    IndexFlagsBits = 6
+};
+
+struct VirtualTable
+{
+    sqlite3_vtab                        base;
+    std::shared_ptr<QsVirtualTableBase> table;
+};
+
+struct VirtualTableCursor
+{
+    sqlite3_vtab_cursor base;
+    QsVirtualTableBase* table;
+    int                 keyColumn;  // -1 for scan in rows order
+    qint64              position;
+    qint64              end;
+};
+
+inline QsVirtualTableBase* tableOf(sqlite3_vtab* vtab) noexcept
+{
+    return reinterpret_cast<VirtualTable*>(vtab)->table.get();
+}
+
+// check if constraint compares values with BINARY collation
+inline bool isBinaryCollation(sqlite3_index_info* info,
+                              const int           constraint) noexcept
+{
+    const char* collation = sqlite3_vtab_collation(info, constraint);
+    return !collation || sqlite3_stricmp(collation, "BINARY") == 0;
+}
+
+inline VirtualTableCursor* cursorOf(sqlite3_vtab_cursor* cursor) noexcept
+{
+    return reinterpret_cast<VirtualTableCursor*>(cursor);
+}
+
+int xConnect(sqlite3*           db,
+             void*              aux,
+             int,
+             const char* const*,
+             sqlite3_vtab**     vtab,
+             char**             errorMsg)
+{
+    try {
+        // declare table columns and create table object
+        const std::shared_ptr<QsVirtualTableBase>& table =
+                *static_cast<std::shared_ptr<QsVirtualTableBase>*>(aux);
+        const int resultCode = sqlite3_declare_vtab(
+                    db, table->declaration().constData());
+        if (resultCode != SQLITE_OK) {
+            return resultCode;
+        }
+
+        *vtab = &(new VirtualTable {sqlite3_vtab(), table})->base;
+        return SQLITE_OK;
+    } catch (const std::bad_alloc&) {
+        return SQLITE_NOMEM;
+    } catch (const std::exception& exception) {
+        *errorMsg = sqlite3_mprintf("%s", exception.what());
+        return SQLITE_ERROR;
+    } catch (...) {
+        return SQLITE_ERROR;
+    }
+}
+
+int xDisconnect(sqlite3_vtab* vtab)
+{
+    delete reinterpret_cast<VirtualTable*>(vtab);
+    return SQLITE_OK;
+}
+
+int xBestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info)
+{
+    const QsVirtualTableBase* table = tableOf(vtab);
+    const double rowCount = static_cast<double>(table->rowCount());
+    const double searchCost = std::log2(rowCount + 1.0) + 1.0;
+
+    // find constraints for each key column (use first usable of each kind)
+    int bestColumn = -1;
+    int bestFlags = 0;
+    int bestScore = 0;
+    int bestConstraints[2] = {-1, -1};
+
+    for (int column = 0, count = table->columnCount();
+         column < count; ++column) {
+        if (!table->isKeyColumn(column)) {
+            continue;
+        }
+
+        // text keys are ordered by Qt, but sqlite compares them by bytes
+        // in database encoding, so they are found only by equality
+        const bool ordered = table->isOrderedKeyColumn(column);
+        int flags = 0;
+        int constraints[3] = {-1, -1, -1};  // equal, lower and upper bound
+        for (int i = 0; i < info->nConstraint; ++i) {
+            const sqlite3_index_info::sqlite3_index_constraint& constraint =
+                    info->aConstraint[i];
+            if (!constraint.usable || constraint.iColumn != column
+                    || !isBinaryCollation(info, i)) {
+                continue;
+            }
+
+            switch (constraint.op) {
+            case SQLITE_INDEX_CONSTRAINT_EQ:
+                if (constraints[0] < 0) {
+                    constraints[0] = i;
+                    flags |= KeyEqual;
+                }
+                break;
+            case SQLITE_INDEX_CONSTRAINT_GT:
+            case SQLITE_INDEX_CONSTRAINT_GE:
+                if (ordered && constraints[1] < 0) {
+                    constraints[1] = i;
+                    flags |= (constraint.op == SQLITE_INDEX_CONSTRAINT_GT)
+                            ? KeyGreater : KeyGreaterOrEq;
+                }
+                break;
+            case SQLITE_INDEX_CONSTRAINT_LT:
+            case SQLITE_INDEX_CONSTRAINT_LE:
+                if (ordered && constraints[2] < 0) {
+                    constraints[2] = i;
+                    flags |= (constraint.op == SQLITE_INDEX_CONSTRAINT_LT)
+                            ? KeyLess : KeyLessOrEq;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        // score column: equality is best, then closed range, then open range
+        int score = 0;
+        if (flags & KeyEqual) {
+            flags = KeyEqual;
+            constraints[1] = constraints[0];
+            constraints[2] = -1;
+            score = 3;
+        } else if (constraints[1] >= 0 || constraints[2] >= 0) {
+            score = (constraints[1] >= 0 && constraints[2] >= 0) ? 2 : 1;
+        }
+
+        if (score > bestScore) {
+            bestColumn = column;
+            bestFlags = flags;
+            bestScore = score;
+            bestConstraints[0] = constraints[1];
+            bestConstraints[1] = constraints[2];
+        }
+    }
+
+    // if there are no constraints, scan by key, if it gives needed order
+    if (bestColumn < 0 && info->nOrderBy == 1
+            && info->aOrderBy[0].iColumn >= 0
+            && !info->aOrderBy[0].desc
+            && table->isOrderedKeyColumn(info->aOrderBy[0].iColumn)) {
+        bestColumn = info->aOrderBy[0].iColumn;
+    }
+
+    if (bestColumn >= 0) {
+        bestFlags |= KeyOrdered;
+
+        // pass constraint values to xFilter (omit is not set, so sqlite
+        // checks constraints for returned rows, but xFilter must not skip
+        // matching rows, so it narrows range only by exact keys)
+        int argvIndex = 0;
+        for (const int constraint : bestConstraints) {
+            if (constraint >= 0) {
+                info->aConstraintUsage[constraint].argvIndex = ++argvIndex;
+                info->aConstraintUsage[constraint].omit = 0;
+            }
+        }
+
+        // rows are returned in ascending key order (collation of ORDER BY
+        // is not known, so order of text keys is not used)
+        if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn == bestColumn
+                && !info->aOrderBy[0].desc
+                && table->isOrderedKeyColumn(bestColumn)) {
+            info->orderByConsumed = 1;
+        }
+
+        double rows = rowCount;
+        if (bestScore == 3) {
+            rows = 1.0;
+        } else if (bestScore == 2) {
+            rows = rowCount / 16.0;
+        } else if (bestScore == 1) {
+            rows = rowCount / 4.0;
+        }
+
+        info->idxNum = (bestColumn << IndexFlagsBits) | bestFlags;
+        info->estimatedCost = (bestScore ? searchCost : 0.0) + rows;
+        info->estimatedRows = static_cast<sqlite3_int64>(rows) + 1;
+    } else {
+        info->idxNum = 0;
+        info->estimatedCost = rowCount;
+        info->estimatedRows = static_cast<sqlite3_int64>(rowCount);
+    }
+
+    return SQLITE_OK;
+}
+
+int xOpen(sqlite3_vtab* vtab, sqlite3_vtab_cursor** cursor)
+{
+    VirtualTableCursor* newCursor = new (std::nothrow) VirtualTableCursor {
+            sqlite3_vtab_cursor(), tableOf(vtab), -1, 0, 0};
+    if (!newCursor) {
+        return SQLITE_NOMEM;
+    }
+
+    *cursor = &newCursor->base;
+    return SQLITE_OK;
+}
+
+int xClose(sqlite3_vtab_cursor* cursor)
+{
+    delete cursorOf(cursor);
+    return SQLITE_OK;
+}
+
+int xFilter(sqlite3_vtab_cursor* vtabCursor,
+            int                  idxNum,
+            const char*,
+            int                  argc,
+            sqlite3_value**      argv)
+{
+    VirtualTableCursor* cursor = cursorOf(vtabCursor);
+    const QsVirtualTableBase* table = cursor->table;
+    const int flags = idxNum & IndexFlagsMask;
+
+    cursor->position = 0;
+    cursor->end = table->rowCount();
+
+    // full scan in rows order
+    if (!(flags & KeyOrdered)) {
+        cursor->keyColumn = -1;
+        return SQLITE_OK;
+    }
+
+    cursor->keyColumn = idxNum >> IndexFlagsBits;
+
+    // comparison with NULL is never true, and value of other type
+    // (or inexact value) gives scan of all rows in key order
+    for (int i = 0; i < argc; ++i) {
+        if (sqlite3_value_type(argv[i]) == SQLITE_NULL) {
+            cursor->end = 0;
+            return SQLITE_OK;
+        }
+    }
+
+    for (int i = 0; i < argc; ++i) {
+        if (!table->isExactKey(cursor->keyColumn, argv[i])) {
+            return SQLITE_OK;
+        }
+    }
+
+    try {
+        int arg = 0;
+        if (flags & KeyEqual) {
+            cursor->position = table->keyBound(cursor->keyColumn,
+                                               argv[arg], false);
+            cursor->end = table->keyBound(cursor->keyColumn,
+                                          argv[arg], true);
+            return SQLITE_OK;
+        }
+
+        if (flags & (KeyGreater | KeyGreaterOrEq)) {
+            cursor->position = table->keyBound(cursor->keyColumn, argv[arg++],
+                                               flags & KeyGreater);
+        }
+
+        if (flags & (KeyLess | KeyLessOrEq)) {
+            cursor->end = table->keyBound(cursor->keyColumn, argv[arg],
+                                          flags & KeyLessOrEq);
+        }
+    } catch (const std::bad_alloc&) {
+        return SQLITE_NOMEM;
+    } catch (...) {
+        return SQLITE_ERROR;
+    }
+
+    return SQLITE_OK;
+}
+
+int xNext(sqlite3_vtab_cursor* cursor)
+{
+    ++cursorOf(cursor)->position;
+    return SQLITE_OK;
+}
+
+int xEof(sqlite3_vtab_cursor* vtabCursor)
+{
+    const VirtualTableCursor* cursor = cursorOf(vtabCursor);
+    return cursor->position >= cursor->end;
+}
+
+int xRowid(sqlite3_vtab_cursor* vtabCursor, sqlite3_int64* rowId)
+{
+    const VirtualTableCursor* cursor = cursorOf(vtabCursor);
+    *rowId = (cursor->keyColumn < 0)
+            ? cursor->position
+            : cursor->table->keyRow(cursor->keyColumn, cursor->position);
+    return SQLITE_OK;
+}
+
+int xColumn(sqlite3_vtab_cursor* vtabCursor,
+            sqlite3_context*     context,
+            int                  column)
+{
+    sqlite3_int64 row;
+    xRowid(vtabCursor, &row);
+
+    try {
+        cursorOf(vtabCursor)->table->result(context, row, column);
+    } catch (const std::bad_alloc&) {
+        return SQLITE_NOMEM;
+    } catch (...) {
+        return SQLITE_ERROR;
+    }
+
+    return SQLITE_OK;
+}
+
+// function build module (without xCreate for eponymous-only tables)
+sqlite3_module buildModule(const bool eponymousOnly) noexcept
+{
+    sqlite3_module module = sqlite3_module();
+
+    module.xCreate = eponymousOnly ? NULL : xConnect;
+    module.xConnect = xConnect;
+    module.xBestIndex = xBestIndex;
+    module.xDisconnect = xDisconnect;
+    module.xDestroy = xDisconnect;
+    module.xOpen = xOpen;
+    module.xClose = xClose;
+    module.xFilter = xFilter;
+    module.xNext = xNext;
+    module.xEof = xEof;
+    module.xColumn = xColumn;
+    module.xRowid = xRowid;
+
+    return module;
+}
+
+const sqlite3_module createModule = buildModule(false);
+
+const sqlite3_module eponymousModule = buildModule(true);
+
+}
+
+
+QByteArray QsVirtualTableBase::declaration() const
+{
+    QByteArray result("create table x(");
+
+    // append quoted column names with declared types
+    for (int column = 0, count = columnCount(); column < count; ++column) {
+        if (column) {
+            result.append(", ");
+        }
+
+        QByteArray name = columnName(column);
+        result.append('"').append(name.replace('"', "\"\"")).append("\" ")
+                .append(columnType(column));
+    }
+
+    result.append(')');
+    return result;
+}
+
+const sqlite3_module*
+QsVirtualTableBase::module(const bool eponymousOnly) noexcept
+{
+    return eponymousOnly ? &eponymousModule : &createModule;
+}